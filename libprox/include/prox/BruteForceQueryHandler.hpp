@@ -37,6 +37,8 @@
 #include <prox/ObjectChangeListener.hpp>
 #include <prox/QueryChangeListener.hpp>
 #include <prox/QueryCache.hpp>
+#include <prox/QueryScheduler.hpp>
+#include <prox/DirtyRegionSet.hpp>
 
 namespace Prox {
 
@@ -48,6 +50,17 @@ public:
     virtual void registerObject(Object* obj);
     virtual void registerQuery(Query* query);
     virtual void tick(const Time& t);
+    virtual void tick(const Time& t, const Duration& budget);
+    virtual Duration staleness(const Query* query, const Time& t) const;
+
+    /// If enabled, each evaluation also computes a conservative time before
+    /// which no object can cross the query's thresholds under its current
+    /// motion, and the query is skipped until then unless an object changes
+    /// near it.  Enabled by default.  Without it, queries are only skipped
+    /// while no registered object is moving, so a single moving object
+    /// anywhere causes every query to be reevaluated each tick.
+    bool validityIntervals() const;
+    void validityIntervals(bool enabled);
 
     // ObjectChangeListener Implementation
     virtual void objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos);
@@ -56,18 +69,61 @@ public:
 
     // QueryChangeListener Implementation
     virtual void queryPositionUpdated(Query* query, const MotionVector3f& old_pos, const MotionVector3f& new_pos);
+    virtual void queryFrustumUpdated(Query* query, const Frustum& old_frustum, const Frustum& new_frustum);
     virtual void queryDeleted(const Query* query);
 
 private:
     struct QueryState {
+        QueryState()
+         : exactTick(0),
+           safeUntil(0)
+        {}
+
         QueryCache cache;
+        uint32 exactTick; // last tick at which cache was known to be exact
+        Time safeUntil; // cache remains exact until then if nothing changes
     };
 
-    typedef std::set<Object*> ObjectSet;
+    // Marks the regions swept by changed objects since the last tick.  Objects
+    // moving along unchanged trajectories are left to validity intervals.
+    void markDirtyRegions(const Time& t);
+    // Returns true if the query's cached result is still exact at time t,
+    // either because neither it nor anything near it changed since the last
+    // tick or because it is within its validity interval
+    bool unaffected(Query* query, QueryState* state, const Time& t) const;
+
+    void evaluateQuery(Query* query, QueryState* state, const Time& t);
+
+    // Copies the object's motion and bounds into its slot in the object arrays
+    void storeObject(uint32 idx, const Object* obj);
+
+    typedef std::map<const Object*, uint32> ObjectIndexMap;
     typedef std::map<Query*, QueryState*> QueryMap;
 
-    ObjectSet mObjects;
+    // Moves mEpoch to t, recomputing all stored positions from their objects
+    void rebase(const Time& t);
+
+    // Objects are stored as structure-of-arrays so tick() can stream through
+    // them.  Positions are the world bounds centers extrapolated to mEpoch,
+    // which keeps the time offsets small enough for single precision.
+    // Removal swaps the last object into the hole.
+    ObjectIndexMap mObjectIndices;
+    std::vector<Object*> mObjects;
+    std::vector<ObjectID> mObjectIDs;
+    std::vector<float> mPositionX, mPositionY, mPositionZ;
+    std::vector<float> mVelocityX, mVelocityY, mVelocityZ;
+    std::vector<float> mRadius;
+    Time mEpoch;
+    std::vector<uint8> mResults; // per-object scratch space for tick()
+
     QueryMap mQueries;
+    QueryScheduler mScheduler;
+    DirtyRegionSet mChangedRegions; // objects with discontinuous changes
+    std::set<Object*> mChangedObjects; // registered or updated since the last tick
+    Time mLastTime;
+    uint32 mTickCount;
+    bool mValidityIntervals;
+    uint32 mMovingObjects; // registered objects with non-zero velocity
 }; // class BruteForceQueryHandler
 
 } // namespace Prox
@@ -0,0 +1,75 @@
+/*  libprox
+ *  DirtyRegionSet.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROX_DIRTY_REGION_SET_HPP_
+#define _PROX_DIRTY_REGION_SET_HPP_
+
+#include <prox/BoundingSphere.hpp>
+#include <prox/Vector3.hpp>
+
+namespace Prox {
+
+/** Tracks the regions of space in which objects changed during a tick, so
+ *  handlers can skip queries that none of the changes could affect.  The
+ *  number of regions is bounded, since testing every query against a large
+ *  set would cost more than it saves, so once the limit is reached further
+ *  regions are merged into the nearest existing ones.
+ */
+class DirtyRegionSet {
+public:
+    DirtyRegionSet();
+    ~DirtyRegionSet();
+
+    /// Mark a region containing an object which may continue moving at up to
+    /// the given speed
+    void mark(const BoundingSphere3f& region, float speed = 0.f);
+    /// Mark the region swept by a sphere moving from one bound to another
+    void mark(const BoundingSphere3f& from, const BoundingSphere3f& to, float speed = 0.f);
+    void markAll();
+    void clear();
+
+    /// Returns true if an object within one of the dirty regions could satisfy
+    /// the given query thresholds, see SolidAngle::maxDistanceRatioSquared.
+    /// If duration is non-zero, also accounts for the objects and the query,
+    /// which moves at qspeed, moving for that many seconds.
+    bool affects(const Vector3f& qpos, float qradius, float qangle_ratio, float qspeed = 0.f, float duration = 0.f) const;
+
+private:
+    typedef std::vector<BoundingSphere3f> RegionList;
+    RegionList mRegions;
+    std::vector<float> mSpeeds;
+    bool mAll;
+}; // class DirtyRegionSet
+
+} // namespace Prox
+
+#endif //_PROX_DIRTY_REGION_SET_HPP_
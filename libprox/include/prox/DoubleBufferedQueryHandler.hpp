@@ -0,0 +1,148 @@
+/*  libprox
+ *  DoubleBufferedQueryHandler.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROX_DOUBLE_BUFFERED_QUERY_HANDLER_HPP_
+#define _PROX_DOUBLE_BUFFERED_QUERY_HANDLER_HPP_
+
+#include <prox/QueryHandler.hpp>
+#include <prox/ObjectChangeListener.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+namespace Prox {
+
+/** Wraps another QueryHandler so objects can be updated from other threads
+ *  while it ticks.  The inner handler indexes private copies of the
+ *  registered objects, which only change inside tick().  Object callbacks
+ *  copy updates into a fixed size lock-free multi-producer queue, and at the
+ *  start of each tick the queue is drained, repeated updates to the same
+ *  object are merged, and the result is applied to the copies as a batch.
+ *  Neither producers nor traversals take a lock or allocate.
+ *
+ *  If more than QueueCapacity updates arrive between ticks the queue fills,
+ *  and producers fall back to appending to a mutex protected overflow list
+ *  until the next tick drains it.  Updates are never dropped and producers
+ *  never wait for a tick, so the handler can also be driven from a single
+ *  thread, but while the overflow is in use producers contend on its lock.
+ *
+ *  Queries are passed directly to the inner handler and must be updated from
+ *  the thread calling tick().
+ */
+class DoubleBufferedQueryHandler : public QueryHandler, public ObjectChangeListener {
+public:
+    /// Takes ownership of inner
+    DoubleBufferedQueryHandler(QueryHandler* inner);
+    virtual ~DoubleBufferedQueryHandler();
+
+    virtual void registerObject(Object* obj);
+    virtual void registerQuery(Query* query);
+    virtual void tick(const Time& t);
+    virtual void tick(const Time& t, const Duration& budget);
+    virtual Duration staleness(const Query* query, const Time& t) const;
+
+    // ObjectChangeListener Implementation
+    virtual void objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos);
+    virtual void objectsPositionUpdated(const ObjectPositionUpdate* updates, std::size_t count);
+    virtual void objectBoundingSphereUpdated(Object* obj, const BoundingSphere3f& old_bounds, const BoundingSphere3f& new_bounds);
+    virtual void objectDeleted(const Object* obj);
+
+private:
+    enum {
+        QueueCapacity = 16384
+    };
+
+    // A single change reported by an object's callbacks.  Plain data so it
+    // can be copied into the queue's preallocated slots.
+    struct ObjectUpdate {
+        enum Type {
+            Registered,
+            Moved,
+            Resized,
+            Deleted
+        };
+
+        Type type;
+        const Object* object;
+        unsigned char id[ObjectID::static_size];
+        uint64 time; // of the position, in microseconds since the epoch
+        float position[3];
+        float velocity[3];
+        float center[3];
+        float radius;
+    };
+
+    // Net change to an object since the last tick
+    struct PendingObject {
+        PendingObject()
+         : id(ObjectID::null()),
+           position(Time(0), Vector3f(0, 0, 0), Vector3f(0, 0, 0)),
+           present(true),
+           added(false),
+           moved(false)
+        {}
+
+        ObjectID id;
+        MotionVector3f position;
+        BoundingSphere3f bounds;
+        bool present; // false if the object was deleted
+        bool added; // the object was (re)registered, replacing any old copy
+        bool moved; // the object's position was updated
+    };
+    typedef std::map<const Object*, PendingObject> PendingObjectMap;
+    typedef std::map<const Object*, Object*> ObjectCopyMap;
+
+    // Copies an update into the queue, or the overflow list if it is full
+    void pushUpdate(ObjectUpdate::Type type, const Object* obj, const MotionVector3f& pos, const BoundingSphere3f& bounds);
+    // Merges an update into mPending
+    void mergeUpdate(const ObjectUpdate& update);
+    // Drains the update queue and overflow list, merging the updates into mPending
+    void drainUpdates();
+    // Drains the update queue and applies the changes to the object copies
+    void applyUpdates();
+
+    QueryHandler* mInner;
+
+    typedef boost::lockfree::queue< ObjectUpdate, boost::lockfree::capacity<QueueCapacity> > UpdateQueue;
+    UpdateQueue mUpdateQueue;
+    // Once set, producers use mOverflow until the next drain so each
+    // producer's updates stay in order
+    boost::atomic<bool> mOverflowing;
+    boost::mutex mOverflowMutex;
+    std::vector<ObjectUpdate> mOverflow;
+    PendingObjectMap mPending; // only used by tick()
+    ObjectCopyMap mObjectCopies; // only used by tick()
+}; // class DoubleBufferedQueryHandler
+
+} // namespace Prox
+
+#endif //_PROX_DOUBLE_BUFFERED_QUERY_HANDLER_HPP_
@@ -52,6 +52,7 @@ public:
 
     float seconds() const;
     float milliseconds() const;
+    int64 microseconds() const;
 
     Duration operator+(const Duration& rhs) const;
     Duration& operator+=(const Duration& rhs);
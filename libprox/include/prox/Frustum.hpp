@@ -0,0 +1,82 @@
+/*  libprox
+ *  Frustum.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROX_FRUSTUM_HPP_
+#define _PROX_FRUSTUM_HPP_
+
+#include <prox/Vector3.hpp>
+#include <prox/Quaternion.hpp>
+#include <prox/BoundingSphere.hpp>
+
+namespace Prox {
+
+/** A symmetric view frustum with its apex at the origin.  It looks down the
+ *  orientation's -Z axis with +Y up, following OpenGL conventions.
+ */
+class Frustum {
+public:
+    /// Create an unbounded frustum, which contains everything
+    Frustum();
+    /// fov is the full vertical field of view in radians, which must be less
+    /// than pi, and aspect is the ratio of the width to the height
+    Frustum(const Quaternion& orientation, float fov, float aspect, float near_dist, float far_dist);
+    Frustum(const Frustum& cpy);
+    ~Frustum();
+
+    Frustum& operator=(const Frustum& rhs);
+
+    bool unbounded() const;
+
+    /// The bounding planes, e.g. for serialization.  A point p is outside
+    /// plane i if planeNormal(i).dot(p - eye) > planeOffset(i).
+    int planeCount() const;
+    const Vector3f& planeNormal(int i) const;
+    float planeOffset(int i) const;
+    /// Recreate a frustum from planes taken from another
+    static Frustum fromPlanes(int count, const Vector3f* normals, const float* offsets);
+
+    /// Returns true if the sphere may intersect the frustum when its apex is
+    /// placed at eye.  This is conservative, spheres near the frustum's edges
+    /// may pass even if they are just outside it.
+    bool intersects(const Vector3f& eye, const BoundingSphere3f& bounds) const;
+private:
+    static const int MaxPlanes = 6;
+
+    // A point p is outside plane i if mNormals[i].dot(p - eye) > mOffsets[i]
+    Vector3f mNormals[MaxPlanes];
+    float mOffsets[MaxPlanes];
+    int mPlaneCount;
+}; // class Frustum
+
+} // namespace Prox
+
+#endif //_PROX_FRUSTUM_HPP_
@@ -56,6 +56,11 @@ public:
     BoundingSphere3f worldBounds(const Time& t) const;
     void position(const MotionVector3f& new_pos);
     void bounds(const BoundingSphere3f& new_bounds);
+
+    /// Update the positions of count objects at once.  Each listener receives a
+    /// single objectsPositionUpdated call covering all of its objects in the batch.
+    static void updatePositions(Object** objs, const MotionVector3f* new_pos, std::size_t count);
+
     void unregister();
     void addChangeListener(ObjectChangeListener* listener);
     void removeChangeListener(ObjectChangeListener* listener);
@@ -40,12 +40,28 @@ namespace Prox {
 
 class Object;
 
+struct ObjectPositionUpdate {
+    ObjectPositionUpdate(Object* obj, const MotionVector3f& _old_pos, const MotionVector3f& _new_pos)
+     : object(obj), old_pos(_old_pos), new_pos(_new_pos)
+    {}
+
+    Object* object;
+    MotionVector3f old_pos;
+    MotionVector3f new_pos;
+};
+
 class ObjectChangeListener {
 public:
     ObjectChangeListener() {}
     virtual ~ObjectChangeListener() {}
 
     virtual void objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos) = 0;
+    /// Called once for a batch of position updates, see Object::updatePositions.
+    /// By default this just dispatches each update to objectPositionUpdated.
+    virtual void objectsPositionUpdated(const ObjectPositionUpdate* updates, std::size_t count) {
+        for(std::size_t i = 0; i < count; i++)
+            objectPositionUpdated(updates[i].object, updates[i].old_pos, updates[i].new_pos);
+    }
     virtual void objectBoundingSphereUpdated(Object* obj, const BoundingSphere3f& old_bounds, const BoundingSphere3f& new_bounds) = 0;
     virtual void objectDeleted(const Object* obj) = 0;
 
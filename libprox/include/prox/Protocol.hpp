@@ -0,0 +1,122 @@
+/*  libprox
+ *  Protocol.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROX_PROTOCOL_HPP_
+#define _PROX_PROTOCOL_HPP_
+
+#include <prox/ObjectID.hpp>
+#include <prox/MotionVector.hpp>
+#include <prox/BoundingSphere.hpp>
+#include <prox/QueryEvent.hpp>
+#include <vector>
+
+namespace Prox {
+
+/** Receives the messages decoded by a ProtocolReader. */
+class ProtocolListener {
+public:
+    ProtocolListener() {}
+    virtual ~ProtocolListener() {}
+
+    /// The sender's copy of an object it owns was created or changed
+    virtual void objectUpdated(const ObjectID& id, const MotionVector3f& pos, const BoundingSphere3f& bounds) = 0;
+    /// The sender no longer shares the object
+    virtual void objectRemoved(const ObjectID& id) = 0;
+    /// Ownership of the object was handed over to the receiver
+    virtual void objectMigrated(const ObjectID& id, const MotionVector3f& pos, const BoundingSphere3f& bounds) = 0;
+    /// Result changes for a query identified by the sender
+    virtual void queryEventsReceived(uint32 query, std::deque<QueryEvent>& events) = 0;
+}; // class ProtocolListener
+
+/** Batches messages into a single frame for sending between processes.  A
+ *  frame is a uint32 payload length followed by the messages, each a uint8
+ *  type and its fields.  Integers and floats are stored little-endian
+ *  regardless of the host, so frames can eventually cross hosts.
+ */
+class ProtocolWriter {
+public:
+    ProtocolWriter();
+    ~ProtocolWriter();
+
+    void objectUpdated(const ObjectID& id, const MotionVector3f& pos, const BoundingSphere3f& bounds);
+    void objectRemoved(const ObjectID& id);
+    void objectMigrated(const ObjectID& id, const MotionVector3f& pos, const BoundingSphere3f& bounds);
+    void queryEvents(uint32 query, const std::deque<QueryEvent>& events);
+
+    bool empty() const;
+    /// The frame containing every message since the last clear()
+    const std::vector<uint8>& frame();
+    void clear();
+
+private:
+    void writeObject(uint8 type, const ObjectID& id, const MotionVector3f& pos, const BoundingSphere3f& bounds);
+    void writeUInt8(uint8 v);
+    void writeUInt32(uint32 v);
+    void writeUInt64(uint64 v);
+    void writeFloat(float v);
+    void writeVector(const Vector3f& v);
+    void writeID(const ObjectID& id);
+
+    std::vector<uint8> mBuffer;
+}; // class ProtocolWriter
+
+/** Reassembles frames from a byte stream and decodes their messages. */
+class ProtocolReader {
+public:
+    ProtocolReader();
+    ~ProtocolReader();
+
+    /// Buffer bytes received from the stream
+    void append(const uint8* data, std::size_t len);
+    /// Decode every complete frame received so far, passing the messages to
+    /// listener.  Returns false if a frame was malformed, after which the
+    /// stream can't be resynchronized.
+    bool dispatch(ProtocolListener* listener);
+
+private:
+    bool readUInt8(uint8* v);
+    bool readUInt32(uint32* v);
+    bool readUInt64(uint64* v);
+    bool readFloat(float* v);
+    bool readVector(Vector3f* v);
+    bool readID(ObjectID* id);
+    // Decodes the fields shared by the object update and migration messages
+    bool readObject(ObjectID* id, MotionVector3f* pos, BoundingSphere3f* bounds);
+
+    std::vector<uint8> mBuffer;
+    std::size_t mOffset; // read position within mBuffer
+    std::size_t mFrameEnd; // end of the frame being decoded
+}; // class ProtocolReader
+
+} // namespace Prox
+
+#endif //_PROX_PROTOCOL_HPP_
@@ -36,6 +36,7 @@
 #include <prox/Platform.hpp>
 #include <prox/SolidAngle.hpp>
 #include <prox/MotionVector.hpp>
+#include <prox/Frustum.hpp>
 #include <prox/QueryEvent.hpp>
 #include <boost/thread.hpp>
 
@@ -50,6 +51,12 @@ public:
 
     const static float InfiniteRadius;
 
+    /// Orders in which results limited by maxResults() are chosen
+    enum Ranking {
+        LargestSolidAngle, // objects subtending the largest solid angles
+        Nearest // objects with the nearest bounds, i.e. k-nearest neighbours
+    };
+
     Query(const MotionVector3f& pos, const SolidAngle& minAngle);
     Query(const MotionVector3f& pos, const SolidAngle& minAngle, float radius);
     Query(const Query& cpy);
@@ -60,14 +67,49 @@ public:
     const SolidAngle& angle() const;
     const float radius() const;
 
+    /// Thresholds an object must continue to satisfy to remain in the result
+    /// once it has been added.  These default to angle() and radius(), i.e. no
+    /// hysteresis, and are always at least as permissive as the entry values.
+    /// Handlers aren't notified of changes, so hysteresis() must be called
+    /// before the query is registered with a handler.
+    const SolidAngle& exitAngle() const;
+    const float exitRadius() const;
+    void hysteresis(const SolidAngle& exit_angle, float exit_radius);
+
+    /// Longest a handler may go without refreshing this query's results.  The
+    /// default of zero asks for a refresh every tick.  With a non-zero value
+    /// handlers may skip refreshes of slow moving, quiet queries.
+    const Duration& maxStaleness() const;
+    void maxStaleness(const Duration& max_staleness);
+
+    /// Limit on the number of results.  If non-zero, only that many of the
+    /// objects satisfying the thresholds are returned, the best according to
+    /// ranking() with ties broken by ObjectID.  Defaults to 0, i.e. no limit.
+    /// Both must be set before the query is registered with a handler.
+    uint32 maxResults() const;
+    void maxResults(uint32 max_results);
+    Ranking ranking() const;
+    void ranking(Ranking r);
+
     void position(const MotionVector3f& new_center);
 
+    /// View frustum, with its apex at the query's position, which objects
+    /// must intersect in addition to satisfying the thresholds.  Defaults to
+    /// an unbounded frustum, i.e. omnidirectional queries.
+    const Frustum& frustum() const;
+    void frustum(const Frustum& new_frustum);
+
     void addChangeListener(QueryChangeListener* listener);
     void removeChangeListener(QueryChangeListener* listener);
 
     void setEventListener(QueryEventListener* listener);
     void removeEventListener();
 
+    /// Whether queued events are coalesced, keeping at most one net pending
+    /// event per object.  Added/Removed pairs which cancel are dropped.
+    bool coalesceEvents() const;
+    void coalesceEvents(bool coalesce);
+
     void pushEvent(const QueryEvent& evt);
     void pushEvents(std::deque<QueryEvent>& evts);
     void popEvents(std::deque<QueryEvent>& evts);
@@ -75,10 +117,18 @@ public:
 protected:
     Query();
     void notifyEventListeners();
+    // Merges evt into mCoalescedEvents. Requires mEventQueueMutex be held.
+    void coalesceEvent(const QueryEvent& evt);
 
     PositionVectorType mPosition;
     SolidAngle mMinSolidAngle;
     float mMaxRadius;
+    SolidAngle mExitSolidAngle;
+    float mExitRadius;
+    Duration mMaxStaleness;
+    uint32 mMaxResults;
+    Ranking mRanking;
+    Frustum mFrustum;
 
     typedef std::list<QueryChangeListener*> ChangeListenerList;
     ChangeListenerList mChangeListeners;
@@ -86,6 +136,9 @@ protected:
 
     typedef std::deque<QueryEvent> EventQueue;
     EventQueue mEventQueue;
+    typedef std::map<ObjectID, QueryEvent::Type> CoalescedEventMap;
+    CoalescedEventMap mCoalescedEvents; // used instead of mEventQueue when coalescing
+    bool mCoalesceEvents;
     bool mNotified; // whether we've notified event listeners of new events
     boost::mutex mEventQueueMutex;
 }; // class Query
@@ -34,6 +34,7 @@
 #define _PROX_QUERY_CHANGE_LISTENER_HPP_
 
 #include <prox/MotionVector.hpp>
+#include <prox/Frustum.hpp>
 
 namespace Prox {
 
@@ -45,6 +46,7 @@ public:
     virtual ~QueryChangeListener() {}
 
     virtual void queryPositionUpdated(Query* query, const MotionVector3f& old_pos, const MotionVector3f& new_pos) = 0;
+    virtual void queryFrustumUpdated(Query* query, const Frustum& old_frustum, const Frustum& new_frustum) = 0;
     virtual void queryDeleted(const Query* query) = 0;
 
 }; // class QueryChangeListener
@@ -0,0 +1,109 @@
+/*  libprox
+ *  QueryConstraints.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _PROX_QUERY_CONSTRAINTS_HPP_
+#define _PROX_QUERY_CONSTRAINTS_HPP_
+
+#include <prox/Query.hpp>
+#include <prox/BoundingSphere.hpp>
+#include <prox/ObjectID.hpp>
+#include <float.h>
+#include <cmath>
+
+namespace Prox {
+
+/* Threshold tests and result ranking shared by the query handlers, so they
+ * all agree on which objects satisfy a query and in what order limited
+ * results are chosen.  qangle_ratio is always the query angle's
+ * SolidAngle::maxDistanceRatioSquared().
+ */
+
+/// Returns true if an object with the given world bounds satisfies the
+/// thresholds.  Frustums are tested separately.
+inline bool QueryConstraints_satisfied(const Vector3f& qpos, float qradius, float qangle_ratio, const BoundingSphere3f& obounds) {
+    float dist_sq = (obounds.center() - qpos).lengthSquared();
+    if (qradius != Query::InfiniteRadius && dist_sq > qradius*qradius)
+        return false;
+    return SolidAngle::satisfiesRatio(qangle_ratio, obounds.radius(), dist_sq);
+}
+
+/// Returns true if an object within a node with the given bounds could
+/// satisfy the thresholds.  Object centers are within the node's radius of
+/// its center, and objects can't subtend a larger solid angle than the node.
+inline bool QueryConstraints_node_satisfied(const Vector3f& qpos, float qradius, float qangle_ratio, const BoundingSphere3f& nbounds) {
+    float dist_sq = (nbounds.center() - qpos).lengthSquared();
+    if (qradius != Query::InfiniteRadius && dist_sq > (qradius+nbounds.radius())*(qradius+nbounds.radius()))
+        return false;
+    return SolidAngle::satisfiesRatio(qangle_ratio, nbounds.radius(), dist_sq);
+}
+
+/// Ranking key, larger is better, for bounds with the given radius whose
+/// center is at the squared distance dist_sq.  For solid angles this is
+/// r^2/d^2, which increases with the solid angle, and for distances it is the
+/// negated distance to the bounds.  For a node this bounds the key of any
+/// object within it since objects are no larger than, and no further out
+/// than, it.
+inline float QueryConstraints_rank_key(float dist_sq, float radius, Query::Ranking ranking) {
+    float r_sq = radius * radius;
+    if (dist_sq <= r_sq)
+        return (ranking == Query::Nearest) ? 0.f : FLT_MAX;
+    if (ranking == Query::Nearest)
+        return radius - sqrtf(dist_sq);
+    return r_sq / dist_sq;
+}
+
+inline float QueryConstraints_rank_key(const BoundingSphere3f& bounds, const Vector3f& qpos, Query::Ranking ranking) {
+    return QueryConstraints_rank_key((bounds.center() - qpos).lengthSquared(), bounds.radius(), ranking);
+}
+
+/// A candidate for a limited result
+struct RankedObject {
+    RankedObject(float _key, const ObjectID& _id)
+     : key(_key), id(_id)
+    {}
+
+    float key;
+    ObjectID id;
+};
+
+/// Returns true if lhs should be returned before rhs, i.e. has a larger key or
+/// the same key and a smaller ID
+inline bool QueryConstraints_ranks_before(const RankedObject& lhs, const RankedObject& rhs) {
+    if (lhs.key != rhs.key)
+        return lhs.key > rhs.key;
+    return lhs.id < rhs.id;
+}
+
+} // namespace Prox
+
+#endif //_PROX_QUERY_CONSTRAINTS_HPP_
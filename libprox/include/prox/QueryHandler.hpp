@@ -36,6 +36,7 @@
 #include <prox/Object.hpp>
 #include <prox/Query.hpp>
 #include <prox/Time.hpp>
+#include <prox/Duration.hpp>
 
 namespace Prox {
 
@@ -47,6 +48,16 @@ public:
     virtual void registerObject(Object* obj) = 0;
     virtual void registerQuery(Query* query) = 0;
     virtual void tick(const Time& t) = 0;
+    /// Evaluate queries until the budget is exhausted, resuming with the next
+    /// query in round-robin order on the following call.  At least one query
+    /// is evaluated per call so every query is eventually refreshed.  The
+    /// budget only bounds query evaluation: bookkeeping which keeps the
+    /// handler consistent with object motion, such as refitting an R-tree,
+    /// always runs in full first and is charged against the budget.
+    virtual void tick(const Time& t, const Duration& budget) = 0;
+    /// Get how out of date the query's results are at time t, i.e. the time
+    /// since they were last evaluated.
+    virtual Duration staleness(const Query* query, const Time& t) const = 0;
 }; // class QueryHandler
 
 } // namespace Prox
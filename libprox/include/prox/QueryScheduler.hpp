@@ -0,0 +1,84 @@
+/*  libprox
+ *  QueryScheduler.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROX_QUERY_SCHEDULER_HPP_
+#define _PROX_QUERY_SCHEDULER_HPP_
+
+#include <prox/Query.hpp>
+#include <prox/Time.hpp>
+#include <prox/Duration.hpp>
+
+namespace Prox {
+
+/** Decides which queries a handler should refresh on a tick.  Each query is
+ *  given a priority which grows with the time since it was last evaluated,
+ *  scaled up by its speed and by the rate its results have been changing,
+ *  and down by its maximum staleness.  Queries whose priority reaches 1 are
+ *  due, and queries which would exceed their maximum staleness before the
+ *  next tick are required.
+ */
+class QueryScheduler {
+public:
+    QueryScheduler();
+    ~QueryScheduler();
+
+    void addQuery(Query* query, const Time& t);
+    void removeQuery(const Query* query);
+
+    /// Record that the query's results were computed at t, generating nevents changes
+    void evaluated(Query* query, const Time& t, uint32 nevents);
+
+    /// Fill in the queries due at t in the order they should be evaluated.  The
+    /// first nrequired must be evaluated to honor their maximum staleness, the
+    /// remainder only as time allows.
+    void schedule(const Time& t, std::vector<Query*>* due, uint32* nrequired);
+
+    Duration staleness(const Query* query, const Time& t) const;
+
+private:
+    struct QueryInfo {
+        QueryInfo(const Time& t)
+         : lastEvaluated(t), churn(0.f)
+        {}
+
+        Time lastEvaluated;
+        float churn; // smoothed result changes per second
+    };
+
+    typedef std::map<Query*, QueryInfo> QueryInfoMap;
+    QueryInfoMap mQueries;
+    Time mLastTick;
+}; // class QueryScheduler
+
+} // namespace Prox
+
+#endif //_PROX_QUERY_SCHEDULER_HPP_
@@ -37,7 +37,10 @@
 #include <prox/ObjectChangeListener.hpp>
 #include <prox/QueryChangeListener.hpp>
 #include <prox/QueryCache.hpp>
+#include <prox/QueryScheduler.hpp>
+#include <prox/DirtyRegionSet.hpp>
 #include <prox/BoundingBox.hpp>
+#include <boost/thread.hpp>
 
 namespace Prox {
 
@@ -51,31 +54,142 @@ public:
     virtual void registerObject(Object* obj);
     virtual void registerQuery(Query* query);
     virtual void tick(const Time& t);
+    /// Refits the whole tree before any queries are evaluated, which costs
+    /// O(objects) regardless of the budget.
+    virtual void tick(const Time& t, const Duration& budget);
+    virtual Duration staleness(const Query* query, const Time& t) const;
+
+    /// If enabled, each evaluation also computes a conservative time before
+    /// which no object can cross the query's thresholds under its current
+    /// motion, and the query is skipped until then unless an object changes
+    /// near it.  Enabled by default.  Without it, queries are only skipped
+    /// while no registered object is moving, so a single moving object
+    /// anywhere causes every query to be reevaluated each tick.
+    bool validityIntervals() const;
+    void validityIntervals(bool enabled);
+
+    /// Write the tree to a flat file, see RTreeSnapshot.hpp, which
+    /// SnapshotQueryHandler can map and query without rebuilding it.  Objects
+    /// are recorded with their bounds at time t but not their motion, so this
+    /// is intended for static scenery.  Returns false if the file couldn't be
+    /// written.
+    bool writeSnapshot(const std::string& path, const Time& t) const;
+
+    /// Measures of how well the tree fits its objects, as of the last tick
+    struct Metrics {
+        uint32 depth; // levels, 1 if the root is a leaf
+        uint32 nodes;
+        uint32 objects;
+        float fillFactor; // average fraction of each node's capacity in use
+        float nodeVolume; // total volume of all nodes' bounds
+        float objectVolume; // total volume of all objects' bounds
+        float siblingOverlap; // total volume shared by pairs of sibling nodes
+        float nodesVisitedPerQuery; // during the last tick
+    };
+    Metrics metrics() const;
+
+    /// Replaces the tree with one bulk loaded from the objects' current
+    /// bounds, in the background if backgroundRebuild() is enabled
+    void rebuild();
+    uint32 rebuildCount() const;
+    /// If positive, the tree is checked periodically and rebuilt once the
+    /// ratio of node volume to object volume exceeds this factor times the
+    /// ratio just after the last rebuild.  Disabled (0) by default.
+    float rebuildThreshold() const;
+    void rebuildThreshold(float factor);
+    /// If enabled, rebuilds run on a separate thread from a snapshot of the
+    /// objects' bounds.  The new tree replaces the current one at the start of
+    /// the first tick after it is ready, once changes to objects made in the
+    /// meantime have been replayed into it.  Disabled by default.
+    bool backgroundRebuild() const;
+    void backgroundRebuild(bool enabled);
+    /// Whether a background rebuild is in progress
+    bool rebuilding() const;
 
     // ObjectChangeListener Implementation
     virtual void objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos);
+    virtual void objectsPositionUpdated(const ObjectPositionUpdate* updates, std::size_t count);
     virtual void objectBoundingSphereUpdated(Object* obj, const BoundingSphere3f& old_bounds, const BoundingSphere3f& new_bounds);
     virtual void objectDeleted(const Object* obj);
 
     // QueryChangeListener Implementation
     virtual void queryPositionUpdated(Query* query, const MotionVector3f& old_pos, const MotionVector3f& new_pos);
+    virtual void queryFrustumUpdated(Query* query, const Frustum& old_frustum, const Frustum& new_frustum);
     virtual void queryDeleted(const Query* query);
 
 private:
     void insert(Object* obj, const Time& t);
-    bool satisfiesConstraints(const Vector3f& qpos, const float qradius, const SolidAngle& qangle, const BoundingSphere3f& obounds);
+    Metrics metrics(const Time& t) const;
+    void rebuild(const Time& t);
+    void startRebuild(const Time& t);
+    void rebuildMain();
+    // Swaps in the background rebuild's tree if it is ready
+    void finishRebuild(const Time& t);
+    // Rebuilds the tree if the rebuild threshold has been crossed
+    void checkQuality(const Time& t);
+    float volumeRatio(const Time& t) const;
+    // Removes the objects from the tree, fixes up the tree and reinserts them
+    void reinsert(std::vector<Object*>& objs, const Time& t);
 
     struct QueryState {
+        QueryState()
+         : exactTick(0),
+           safeUntil(0)
+        {}
+
         QueryCache cache;
+        uint32 exactTick; // last tick at which cache was known to be exact
+        Time safeUntil; // cache remains exact until then if nothing changes
     };
 
-    typedef std::set<Object*> ObjectSet;
+    // Marks the regions swept by changed objects since the last tick.  Objects
+    // moving along unchanged trajectories are left to validity intervals.
+    void markDirtyRegions(const Time& t);
+    // Returns true if the query's cached result is still exact at time t,
+    // either because neither it nor anything near it changed since the last
+    // tick or because it is within its validity interval
+    bool unaffected(Query* query, QueryState* state, const Time& t) const;
+
+    void evaluateQuery(Query* query, QueryState* state, const Time& t);
+    // Collects all objects satisfying the query, returning its validity interval
+    float collectAll(Query* query, QueryState* state, const Time& t, QueryCache* newcache);
+    // Collects the query's best maxResults() objects according to its ranking
+    void collectRanked(Query* query, QueryState* state, const Time& t, QueryCache* newcache);
+
+    typedef std::map<Object*, RTreeNode*> ObjectLeafMap;
     typedef std::map<Query*, QueryState*> QueryMap;
 
     RTreeNode* mRTreeRoot;
-    ObjectSet mObjects;
+    ObjectLeafMap mObjects; // object -> leaf node containing it
     QueryMap mQueries;
+    QueryScheduler mScheduler;
+    DirtyRegionSet mChangedRegions; // objects with discontinuous changes
+    std::set<Object*> mChangedObjects; // registered or updated since the last tick
     Time mLastTime;
+    uint32 mTickCount;
+    bool mValidityIntervals;
+    uint32 mMovingObjects; // registered objects with non-zero velocity
+    uint32 mVisitCount; // children tested during the current tick
+    uint32 mPrunedCount; // nodes pruned during the current tick
+    uint32 mNodeVisitCount; // nodes expanded during the current tick
+    uint32 mEvaluatedCount; // queries evaluated during the current tick
+    uint8 mElementsPerNode;
+    float mRebuildThreshold;
+    float mBaseVolumeRatio; // node to object volume after the last rebuild, or 0
+    uint32 mRebuildCount;
+
+    bool mBackgroundRebuild;
+    boost::thread* mRebuildThread; // NULL unless a background rebuild is in progress
+    boost::mutex mRebuildMutex; // protects mRebuildDone and mRebuildRoot
+    bool mRebuildDone;
+    // Only the rebuild thread uses these until it is done
+    std::vector<Object*> mRebuildObjects;
+    std::vector<BoundingSphere3f> mRebuildBounds;
+    RTreeNode* mRebuildRoot;
+    ObjectLeafMap mRebuildLeaves;
+    // Changes to replay into the rebuilt tree
+    std::set<Object*> mRebuildChanged; // registered, moved or resized
+    std::set<Object*> mRebuildDeleted;
 }; // class RTreeQueryHandler
 
 } // namespace Prox
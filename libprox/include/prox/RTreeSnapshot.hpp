@@ -0,0 +1,81 @@
+/*  libprox
+ *  RTreeSnapshot.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROX_RTREE_SNAPSHOT_HPP_
+#define _PROX_RTREE_SNAPSHOT_HPP_
+
+#include <prox/Platform.hpp>
+#include <prox/ObjectID.hpp>
+
+namespace Prox {
+
+/** Layout of an R-tree snapshot file, written by
+ *  RTreeQueryHandler::writeSnapshot and queried in place by
+ *  SnapshotQueryHandler.  The file is a header followed by the node array and
+ *  the object array.  Children refer to each other by array index rather
+ *  than pointer, so the file can be mapped at any address.  The children of
+ *  a node are contiguous, and node 0 is the root.
+ *
+ *  Fields are in the writer's byte order, which the reader checks against
+ *  its own.
+ */
+
+static const char RTreeSnapshot_magic[8] = { 'P', 'R', 'O', 'X', 'R', 'T', 'S', 'N' };
+static const uint32 RTreeSnapshot_byte_order = 0x01020304;
+static const uint32 RTreeSnapshot_version = 1;
+
+struct RTreeSnapshotHeader {
+    char magic[8];
+    uint32 byteOrder; // RTreeSnapshot_byte_order as written by the writer
+    uint32 version;
+    uint32 nodeCount;
+    uint32 objectCount;
+    uint64 time; // microseconds since the epoch at which bounds were taken
+};
+
+struct RTreeSnapshotNode {
+    float center[3];
+    float radius;
+    uint32 firstChild; // index into the node array, or object array for leaves
+    uint32 count;
+    uint32 leaf;
+};
+
+struct RTreeSnapshotObject {
+    uint8 id[ObjectID::static_size];
+    float center[3]; // world bounds at the snapshot time
+    float radius;
+};
+
+} // namespace Prox
+
+#endif //_PROX_RTREE_SNAPSHOT_HPP_
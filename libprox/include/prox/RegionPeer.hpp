@@ -0,0 +1,142 @@
+/*  libprox
+ *  RegionPeer.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROX_REGION_PEER_HPP_
+#define _PROX_REGION_PEER_HPP_
+
+#include <prox/QueryHandler.hpp>
+#include <prox/ObjectChangeListener.hpp>
+#include <prox/BoundingBox.hpp>
+#include <prox/Protocol.hpp>
+
+namespace Prox {
+
+class RegionPeerListener {
+public:
+    RegionPeerListener() {}
+    virtual ~RegionPeerListener() {}
+
+    /// The peer handed an object over to this process.  It has already been
+    /// registered with the handler and is tracked by the peer, and the
+    /// listener takes ownership of it.
+    virtual void objectArrived(Object* obj) = 0;
+    /// An object was handed over to the peer and is no longer tracked.  The
+    /// listener should stop simulating it and delete it.
+    virtual void objectDeparted(Object* obj) = 0;
+    virtual void queryEventsReceived(uint32 query, std::deque<QueryEvent>& events) = 0;
+}; // class RegionPeerListener
+
+/** Connects the handler of a process owning one region of the world to the
+ *  process owning a neighbouring region, over a stream socket.  Objects owned
+ *  by this process are mirrored to the peer while their centers are within
+ *  margin of its region, which should be at least the largest query radius
+ *  used there, and are handed over once their centers enter it.  Mirrors of
+ *  the peer's objects are registered with the handler, so local queries see
+ *  objects across the boundary.  Query events can also be forwarded, for
+ *  clients whose queries are evaluated by the other process.
+ *
+ *  Changes are batched into one frame per send(), and received frames are
+ *  only applied in receive(), so both should be called from the thread
+ *  ticking the handler.
+ */
+class RegionPeer : public ObjectChangeListener, public ProtocolListener {
+public:
+    /// Takes ownership of the connected socket fd.  The handler must outlive
+    /// the peer.
+    RegionPeer(QueryHandler* handler, const BoundingBox3f& remote_region, float margin, int fd, RegionPeerListener* listener);
+    virtual ~RegionPeer();
+
+    /// Create a Unix domain socket listening at path, returning its fd or -1
+    static int listen(const std::string& path);
+    /// Accept a connection on a listening socket, returning its fd or -1
+    static int accept(int listen_fd);
+    /// Connect to a Unix domain socket at path, returning its fd or -1
+    static int connect(const std::string& path);
+
+    /// Track an object owned by this process
+    void addObject(Object* obj);
+    /// Queue query events to forward to the peer on the next send()
+    void forwardEvents(uint32 query, const std::deque<QueryEvent>& events);
+
+    /// Send the changes to boundary objects as of time t, and hand over
+    /// objects which have entered the peer's region.  Returns false if the
+    /// connection failed.
+    bool send(const Time& t);
+    /// Apply everything received from the peer without blocking.  Returns
+    /// false if the connection was closed or failed.
+    bool receive();
+
+    // ObjectChangeListener Implementation
+    virtual void objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos);
+    virtual void objectBoundingSphereUpdated(Object* obj, const BoundingSphere3f& old_bounds, const BoundingSphere3f& new_bounds);
+    virtual void objectDeleted(const Object* obj);
+
+    // ProtocolListener Implementation
+    virtual void objectUpdated(const ObjectID& id, const MotionVector3f& pos, const BoundingSphere3f& bounds);
+    virtual void objectRemoved(const ObjectID& id);
+    virtual void objectMigrated(const ObjectID& id, const MotionVector3f& pos, const BoundingSphere3f& bounds);
+    virtual void queryEventsReceived(uint32 query, std::deque<QueryEvent>& events);
+
+private:
+    struct LocalObject {
+        LocalObject()
+         : mirrored(false),
+           changed(true)
+        {}
+
+        bool mirrored; // the peer has a mirror of the object
+        bool changed; // updated since the mirror was last sent
+    };
+
+    typedef std::map<Object*, LocalObject> LocalObjectMap;
+    typedef std::map<ObjectID, Object*> MirrorMap;
+
+    // Squared distance from the point to the peer's region
+    float remoteDistanceSquared(const Vector3f& pos) const;
+    bool remoteContains(const Vector3f& pos) const;
+    bool writeAll(const std::vector<uint8>& data);
+
+    QueryHandler* mHandler;
+    BoundingBox3f mRemoteRegion;
+    float mMargin;
+    int mSocket;
+    RegionPeerListener* mListener;
+
+    LocalObjectMap mLocalObjects;
+    MirrorMap mMirrors; // owned by us, registered with mHandler
+    ProtocolWriter mWriter;
+    ProtocolReader mReader;
+}; // class RegionPeer
+
+} // namespace Prox
+
+#endif //_PROX_REGION_PEER_HPP_
@@ -0,0 +1,169 @@
+/*  libprox
+ *  ShardedQueryHandler.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROX_SHARDED_QUERY_HANDLER_HPP_
+#define _PROX_SHARDED_QUERY_HANDLER_HPP_
+
+#include <prox/QueryHandler.hpp>
+#include <prox/ObjectChangeListener.hpp>
+#include <prox/QueryChangeListener.hpp>
+#include <prox/QueryCache.hpp>
+#include <prox/BoundingBox.hpp>
+#include <boost/thread.hpp>
+
+namespace Prox {
+
+/** Splits space into a static grid of regions, each indexed by its own inner
+ *  QueryHandler which is ticked on its own worker thread.  Objects belong to
+ *  the region containing their center, which is the point the query radius
+ *  is tested against, and are migrated between regions as their motion
+ *  carries them across boundaries.  The outer regions extend to infinity, so
+ *  every point belongs to some region.
+ *
+ *  Each query is fanned out to the regions its exit radius reaches as a
+ *  private copy registered with their handlers, and the copies' results are
+ *  merged before events are delivered.  An object migrating between two
+ *  regions a query covers therefore generates no events.  Limited results are
+ *  re-ranked over the union of the regions' best objects.
+ *
+ *  Like the other handlers, objects and queries must be updated from the
+ *  thread calling tick(); wrap this in a DoubleBufferedQueryHandler to
+ *  update objects from other threads.
+ */
+class ShardedQueryHandler : public QueryHandler, public ObjectChangeListener, public QueryChangeListener {
+public:
+    /// Divides region into nx * ny * nz cells.  handlers holds one inner
+    /// handler per cell, with cell (x, y, z) at index x + nx * (y + ny * z).
+    /// Takes ownership of the handlers.
+    ShardedQueryHandler(const BoundingBox3f& region, uint32 nx, uint32 ny, uint32 nz, const std::vector<QueryHandler*>& handlers);
+    virtual ~ShardedQueryHandler();
+
+    virtual void registerObject(Object* obj);
+    virtual void registerQuery(Query* query);
+    virtual void tick(const Time& t);
+    virtual void tick(const Time& t, const Duration& budget);
+    virtual Duration staleness(const Query* query, const Time& t) const;
+
+    // ObjectChangeListener Implementation
+    virtual void objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos);
+    virtual void objectsPositionUpdated(const ObjectPositionUpdate* updates, std::size_t count);
+    virtual void objectBoundingSphereUpdated(Object* obj, const BoundingSphere3f& old_bounds, const BoundingSphere3f& new_bounds);
+    virtual void objectDeleted(const Object* obj);
+
+    // QueryChangeListener Implementation
+    virtual void queryPositionUpdated(Query* query, const MotionVector3f& old_pos, const MotionVector3f& new_pos);
+    virtual void queryFrustumUpdated(Query* query, const Frustum& old_frustum, const Frustum& new_frustum);
+    virtual void queryDeleted(const Query* query);
+
+private:
+    typedef std::multimap<Time, Object*> MigrationQueue;
+    typedef std::set<ObjectID> IDSet;
+
+    struct ObjectState {
+        Object* copy; // registered with the owning shard's handler
+        uint32 shard;
+        MigrationQueue::iterator migration; // or mMigrations.end() if stationary
+    };
+
+    // A query's copy registered with one shard, and its current results
+    struct ShardQuery {
+        Query* query;
+        IDSet results;
+    };
+    typedef std::map<uint32, ShardQuery> ShardQueryMap;
+
+    struct QueryState {
+        QueryState()
+         : dirty(false)
+        {}
+
+        ShardQueryMap shards;
+        QueryCache cache; // merged results delivered to the query
+        // Members which migrated and satisfy the exit thresholds, but which
+        // their new shard hasn't admitted since it only knows them as new
+        IDSet carried;
+        bool dirty; // the shard results changed since cache was computed
+    };
+
+    typedef std::map<Object*, ObjectState> ObjectMap;
+    typedef std::map<ObjectID, Object*> ObjectIDMap;
+    typedef std::map<Query*, QueryState*> QueryMap;
+
+    // Index of the cell containing v along the given axis, clamped to the grid
+    uint32 cellCoordinate(float v, uint32 axis) const;
+    uint32 shardIndex(const Vector3f& pos) const;
+
+    // Registers a copy of the object with the shard containing it at time t
+    void addToShard(Object* obj, ObjectState* state, const Time& t);
+    // Computes when the object will leave its shard, as of time t
+    void scheduleMigration(Object* obj, ObjectState* state, const Time& t);
+    void unscheduleMigration(ObjectState* state);
+    // Moves objects which have left their shards by time t
+    void migrateObjects(const Time& t);
+
+    // Adds and removes the query's copies to match the shards it reaches at t
+    void updateFanOut(Query* query, QueryState* state, const Time& t);
+    void removeShardQuery(QueryState* state, ShardQueryMap::iterator it);
+    // Collects the shards' events and delivers the merged changes
+    void deliverResults(Query* query, QueryState* state, const Time& t);
+
+    // Ticks every shard on its worker and waits for them to finish
+    void tickShards(const Time& t, const Duration* budget);
+    void workerMain(uint32 shard);
+
+    BoundingBox3f mRegion;
+    uint32 mDivisions[3];
+    Vector3f mCellSize;
+
+    std::vector<QueryHandler*> mShards;
+    boost::thread_group mWorkers;
+    boost::mutex mWorkMutex; // protects the tick parameters and counters below
+    boost::condition_variable mWorkCondition; // new work or shutdown
+    boost::condition_variable mDoneCondition; // a worker finished
+    uint32 mWorkGeneration; // incremented for each tick handed to the workers
+    uint32 mWorkRemaining; // workers yet to finish the current tick
+    Time mWorkTime;
+    Duration mWorkBudget;
+    bool mWorkBudgeted;
+    bool mShutdown;
+
+    ObjectMap mObjects;
+    ObjectIDMap mObjectIDs;
+    MigrationQueue mMigrations; // objects by the time they leave their shard
+    IDSet mMigrated; // objects which changed shards during the current tick
+    QueryMap mQueries;
+    Time mLastTime;
+}; // class ShardedQueryHandler
+
+} // namespace Prox
+
+#endif //_PROX_SHARDED_QUERY_HANDLER_HPP_
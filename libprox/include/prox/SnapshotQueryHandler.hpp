@@ -0,0 +1,103 @@
+/*  libprox
+ *  SnapshotQueryHandler.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROX_SNAPSHOT_QUERY_HANDLER_HPP_
+#define _PROX_SNAPSHOT_QUERY_HANDLER_HPP_
+
+#include <prox/QueryHandler.hpp>
+#include <prox/QueryChangeListener.hpp>
+#include <prox/QueryCache.hpp>
+#include <prox/QueryScheduler.hpp>
+#include <prox/RTreeSnapshot.hpp>
+
+namespace Prox {
+
+/** Read-only handler over an R-tree snapshot written by
+ *  RTreeQueryHandler::writeSnapshot.  The file is mapped and traversed in
+ *  place, so opening a snapshot only costs mapping it and checking its node
+ *  array, without copying anything.
+ *  Objects can't be registered, since the snapshot is immutable; dynamic
+ *  objects should be indexed by a separate handler.  Because the scene is
+ *  static, a stationary query is only re-evaluated after it changes.
+ */
+class SnapshotQueryHandler : public QueryHandler, public QueryChangeListener {
+public:
+    SnapshotQueryHandler(const std::string& path);
+    virtual ~SnapshotQueryHandler();
+
+    /// Whether the snapshot was mapped and has a valid header and node array.
+    /// Files whose nodes refer outside the node or object arrays are rejected.
+    bool valid() const;
+    uint32 objectCount() const;
+
+    /// Not supported, snapshots are read-only
+    virtual void registerObject(Object* obj);
+    virtual void registerQuery(Query* query);
+    virtual void tick(const Time& t);
+    virtual void tick(const Time& t, const Duration& budget);
+    virtual Duration staleness(const Query* query, const Time& t) const;
+
+    // QueryChangeListener Implementation
+    virtual void queryPositionUpdated(Query* query, const MotionVector3f& old_pos, const MotionVector3f& new_pos);
+    virtual void queryFrustumUpdated(Query* query, const Frustum& old_frustum, const Frustum& new_frustum);
+    virtual void queryDeleted(const Query* query);
+
+private:
+    struct QueryState {
+        QueryState()
+         : exact(false)
+        {}
+
+        QueryCache cache;
+        bool exact; // cache can't change until the query does
+    };
+
+    void evaluateQuery(Query* query, QueryState* state, const Time& t);
+    void collectAll(Query* query, QueryState* state, const Time& t, QueryCache* newcache);
+    void collectRanked(Query* query, QueryState* state, const Time& t, QueryCache* newcache);
+
+    typedef std::map<Query*, QueryState*> QueryMap;
+
+    void* mMapping;
+    std::size_t mMappingSize;
+    const RTreeSnapshotHeader* mHeader;
+    const RTreeSnapshotNode* mNodes;
+    const RTreeSnapshotObject* mObjects;
+
+    QueryMap mQueries;
+    QueryScheduler mScheduler;
+    Time mLastTime;
+}; // class SnapshotQueryHandler
+
+} // namespace Prox
+
+#endif //_PROX_SNAPSHOT_QUERY_HANDLER_HPP_
@@ -35,6 +35,8 @@
 
 #include <prox/ArcAngle.hpp>
 #include <prox/Vector3.hpp>
+#include <float.h>
+#include <cmath>
 
 namespace Prox {
 
@@ -57,6 +59,26 @@ public:
     /// Get the solid angle represented by the circular area with the given vector to its center and radius
     static SolidAngle fromCenterRadius(const Vector3f& to_center, float radius);
 
+    /// Get the largest squared distance to radius ratio, k, for which a sphere
+    /// subtends at least this solid angle, i.e. fromCenterRadius(to_center, radius)
+    /// is not less than this iff radius*radius*k >= to_center.lengthSquared().
+    /// Compute this once per query to test many spheres without sqrt or division.
+    float maxDistanceRatioSquared() const;
+
+    /// Returns true if a sphere with the given radius, whose center is at the
+    /// squared distance dist_sq, satisfies a solid angle with the given
+    /// maxDistanceRatioSquared().  Min is satisfied by everything, including
+    /// zero radius objects, which the product alone would reject.  Every
+    /// handler should use this rather than testing the ratio directly.
+    static bool satisfiesRatio(float ratio, float radius, float dist_sq) {
+        return ratio == FLT_MAX || radius * radius * ratio >= dist_sq;
+    }
+    /// Get the largest distance at which a sphere with the given radius
+    /// satisfies a solid angle with the given maxDistanceRatioSquared()
+    static float maxDistance(float ratio, float radius) {
+        return (ratio == FLT_MAX) ? FLT_MAX : sqrtf(ratio) * radius;
+    }
+
     SolidAngle operator+(const SolidAngle& rhs) const;
     SolidAngle& operator+=(const SolidAngle& rhs);
     SolidAngle operator-(const SolidAngle& rhs) const;
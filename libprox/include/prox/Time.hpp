@@ -45,6 +45,9 @@ public:
     Time(const Time& cpy);
     ~Time();
 
+    /// Microseconds since the epoch, e.g. for serialization
+    uint64 microseconds() const;
+
     Time operator+(const Duration& dt) const;
     Time& operator+=(const Duration& dt);
 
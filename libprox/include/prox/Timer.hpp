@@ -1,4 +1,4 @@
-/*  proxsim
+/*  libprox
  *  Timer.hpp
  *
  *  Copyright (c) 2009, Ewen Cheslack-Postava
@@ -30,14 +30,14 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#ifndef _PROXSIM_TIMER_HPP_
-#define _PROXSIM_TIMER_HPP_
+#ifndef _PROX_TIMER_HPP_
+#define _PROX_TIMER_HPP_
 
 #include <prox/Time.hpp>
 #include <prox/Duration.hpp>
 #include <boost/date_time.hpp>
 
-namespace ProxSim {
+namespace Prox {
 
 class Timer {
 public:
@@ -45,13 +45,13 @@ public:
     ~Timer();
 
     void start();
-    Prox::Time now();
-    Prox::Duration elapsed();
+    Time now();
+    Duration elapsed();
 
 private:
     boost::posix_time::ptime mStart;
 }; // class Timer
 
-} // namespace ProxSim
+} // namespace Prox
 
-#endif //_PROXSIM_TIMER_HPP_
+#endif //_PROX_TIMER_HPP_
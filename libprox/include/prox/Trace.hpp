@@ -0,0 +1,72 @@
+/*  libprox
+ *  Trace.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROX_TRACE_HPP_
+#define _PROX_TRACE_HPP_
+
+#include <prox/Platform.hpp>
+
+namespace Prox {
+
+/** Format of the workload traces written by TraceRecorder and replayed by
+ *  TraceReplayer.  A trace is the magic and version followed by a stream of
+ *  records, each a uint8 TraceRecordType and its fields, all little-endian.
+ *  Objects and queries are numbered in registration order and referred to
+ *  by that index, so only registrations carry full object IDs.
+ *
+ *  Motion vectors are the update time in microseconds and the position and
+ *  velocity, bounds are the center and radius, and frusta are the plane
+ *  count followed by each plane's normal and offset.
+ */
+
+static const char Trace_magic[8] = { 'P', 'R', 'O', 'X', 'T', 'R', 'C', 'E' };
+static const uint32 Trace_version = 1;
+
+enum TraceRecordType {
+    Trace_ObjectRegistered = 1, // index, id, motion, bounds
+    Trace_ObjectMoved = 2, // index, motion
+    Trace_ObjectsMoved = 3, // count, then count (index, motion)
+    Trace_ObjectResized = 4, // index, bounds
+    Trace_ObjectDeleted = 5, // index
+    // index, motion, angle, radius, exit angle, exit radius, max staleness,
+    // max results, ranking, frustum
+    Trace_QueryRegistered = 6,
+    Trace_QueryMoved = 7, // index, motion
+    Trace_QueryFrustum = 8, // index, frustum
+    Trace_QueryDeleted = 9, // index
+    Trace_Tick = 10, // time
+    Trace_BudgetedTick = 11 // time, budget in microseconds
+};
+
+} // namespace Prox
+
+#endif //_PROX_TRACE_HPP_
@@ -0,0 +1,102 @@
+/*  libprox
+ *  TraceRecorder.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROX_TRACE_RECORDER_HPP_
+#define _PROX_TRACE_RECORDER_HPP_
+
+#include <prox/QueryHandler.hpp>
+#include <prox/ObjectChangeListener.hpp>
+#include <prox/QueryChangeListener.hpp>
+#include <cstdio>
+
+namespace Prox {
+
+/** Wraps another QueryHandler, recording every registration, object and
+ *  query change, and tick to a binary trace, see Trace.hpp, while passing
+ *  them through.  TraceReplayer can then drive any handler with exactly the
+ *  same workload.  The trace is written out at each tick.
+ */
+class TraceRecorder : public QueryHandler, public ObjectChangeListener, public QueryChangeListener {
+public:
+    /// Takes ownership of inner
+    TraceRecorder(QueryHandler* inner, const std::string& path);
+    virtual ~TraceRecorder();
+
+    /// Whether the trace file could be opened and all writes have succeeded
+    bool valid() const;
+
+    virtual void registerObject(Object* obj);
+    virtual void registerQuery(Query* query);
+    virtual void tick(const Time& t);
+    virtual void tick(const Time& t, const Duration& budget);
+    virtual Duration staleness(const Query* query, const Time& t) const;
+
+    // ObjectChangeListener Implementation
+    virtual void objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos);
+    virtual void objectsPositionUpdated(const ObjectPositionUpdate* updates, std::size_t count);
+    virtual void objectBoundingSphereUpdated(Object* obj, const BoundingSphere3f& old_bounds, const BoundingSphere3f& new_bounds);
+    virtual void objectDeleted(const Object* obj);
+
+    // QueryChangeListener Implementation
+    virtual void queryPositionUpdated(Query* query, const MotionVector3f& old_pos, const MotionVector3f& new_pos);
+    virtual void queryFrustumUpdated(Query* query, const Frustum& old_frustum, const Frustum& new_frustum);
+    virtual void queryDeleted(const Query* query);
+
+private:
+    void writeUInt8(uint8 v);
+    void writeUInt32(uint32 v);
+    void writeUInt64(uint64 v);
+    void writeFloat(float v);
+    void writeVector(const Vector3f& v);
+    void writeMotion(const MotionVector3f& motion);
+    void writeBounds(const BoundingSphere3f& bounds);
+    void writeFrustum(const Frustum& frustum);
+    // Writes the buffered records to the file
+    void flush();
+
+    typedef std::map<const Object*, uint32> ObjectIndexMap;
+    typedef std::map<const Query*, uint32> QueryIndexMap;
+
+    QueryHandler* mInner;
+    FILE* mFile;
+    bool mValid;
+    std::vector<uint8> mBuffer; // records since the last flush
+
+    ObjectIndexMap mObjectIndices;
+    uint32 mObjectCount; // objects registered so far
+    QueryIndexMap mQueryIndices;
+    uint32 mQueryCount; // queries registered so far
+}; // class TraceRecorder
+
+} // namespace Prox
+
+#endif //_PROX_TRACE_RECORDER_HPP_
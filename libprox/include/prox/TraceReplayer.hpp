@@ -0,0 +1,103 @@
+/*  libprox
+ *  TraceReplayer.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROX_TRACE_REPLAYER_HPP_
+#define _PROX_TRACE_REPLAYER_HPP_
+
+#include <prox/QueryHandler.hpp>
+
+namespace Prox {
+
+/** Replays a trace written by TraceRecorder against any QueryHandler, as
+ *  fast as the handler allows.  The replayer creates and owns the traced
+ *  objects and queries, and discards the queries' events after each tick,
+ *  keeping only a count, so handlers can be compared on identical load.
+ *  The handler must outlive the replayer.
+ */
+class TraceReplayer {
+public:
+    TraceReplayer(const std::string& path);
+    ~TraceReplayer();
+
+    /// Whether the trace was read and has a valid header
+    bool valid() const;
+    /// Whether the whole trace has been replayed, or a malformed record found
+    bool finished() const;
+
+    /// Apply the records before the next tick without ticking, so the tick
+    /// can be timed on its own by the following step().  Returns false if
+    /// there are no more ticks.
+    bool applyUpdates(QueryHandler* handler);
+    /// Apply the trace up to and including the next tick, returning false if
+    /// there are no more ticks
+    bool step(QueryHandler* handler);
+    /// Replay the rest of the trace, returning the number of ticks
+    uint32 run(QueryHandler* handler);
+
+    /// Time of the last tick replayed
+    const Time& time() const;
+    /// Total number of query events generated so far
+    uint64 eventCount() const;
+    /// Number of queries registered so far, including deleted ones
+    uint32 queryCount() const;
+    /// The query with the given trace index, or NULL if it has been deleted
+    Query* query(uint32 idx) const;
+
+private:
+    bool readUInt8(uint8* v);
+    bool readUInt32(uint32* v);
+    bool readUInt64(uint64* v);
+    bool readFloat(float* v);
+    bool readVector(Vector3f* v);
+    bool readMotion(MotionVector3f* motion);
+    bool readBounds(BoundingSphere3f* bounds);
+    bool readFrustum(Frustum* frustum);
+
+    // Apply a single record, setting ticked if it was a tick
+    bool replayRecord(QueryHandler* handler, bool* ticked);
+    Object* object(uint32 idx) const;
+    void collectEvents();
+
+    std::vector<uint8> mData;
+    std::size_t mOffset;
+    bool mValid;
+    bool mFinished;
+
+    std::vector<Object*> mObjects; // by trace index, NULL once deleted
+    std::vector<Query*> mQueries; // by trace index, NULL once deleted
+    Time mTime;
+    uint64 mEventCount;
+}; // class TraceReplayer
+
+} // namespace Prox
+
+#endif //_PROX_TRACE_REPLAYER_HPP_
@@ -0,0 +1,127 @@
+/*  libprox
+ *  ValidatingQueryHandler.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROX_VALIDATING_QUERY_HANDLER_HPP_
+#define _PROX_VALIDATING_QUERY_HANDLER_HPP_
+
+#include <prox/QueryHandler.hpp>
+#include <prox/ObjectChangeListener.hpp>
+#include <prox/QueryChangeListener.hpp>
+
+namespace Prox {
+
+/** Runs a candidate QueryHandler on the same objects and queries as a naive
+ *  reference evaluation, and after each tick compares the results of every
+ *  query the candidate evaluated exactly.  The reference tests every object's
+ *  Object::worldBounds() against every query each tick, with no caching,
+ *  skipping or SIMD, and shares only the QueryConstraints threshold tests
+ *  and ranking with the optimized handlers.
+ *  Queries receive the candidate's events, so this can wrap a handler in
+ *  place.  Differences are recorded as divergences; results the candidate
+ *  leaves stale within the query's maximum staleness are not compared.
+ */
+class ValidatingQueryHandler : public QueryHandler, public ObjectChangeListener, public QueryChangeListener {
+public:
+    struct Divergence {
+        enum Type {
+            Missed, // the reference included the object, the candidate didn't
+            Spurious // the candidate included the object, the reference didn't
+        };
+
+        Divergence(const Time& _time, const Query* _query, const ObjectID& _object, Type _type)
+         : time(_time), query(_query), object(_object), type(_type)
+        {}
+
+        Time time;
+        const Query* query; // may since have been deleted
+        ObjectID object;
+        Type type;
+    };
+
+    /// Takes ownership of candidate
+    ValidatingQueryHandler(QueryHandler* candidate);
+    virtual ~ValidatingQueryHandler();
+
+    virtual void registerObject(Object* obj);
+    virtual void registerQuery(Query* query);
+    virtual void tick(const Time& t);
+    virtual void tick(const Time& t, const Duration& budget);
+    virtual Duration staleness(const Query* query, const Time& t) const;
+
+    /// Total number of divergences found
+    uint32 divergenceCount() const;
+    /// The first maxRecorded() divergences since the last clearDivergences()
+    const std::vector<Divergence>& divergences() const;
+    void clearDivergences();
+    uint32 maxRecorded() const;
+    void maxRecorded(uint32 max_recorded);
+
+    // ObjectChangeListener Implementation
+    virtual void objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos);
+    virtual void objectBoundingSphereUpdated(Object* obj, const BoundingSphere3f& old_bounds, const BoundingSphere3f& new_bounds);
+    virtual void objectDeleted(const Object* obj);
+
+    // QueryChangeListener Implementation
+    virtual void queryPositionUpdated(Query* query, const MotionVector3f& old_pos, const MotionVector3f& new_pos);
+    virtual void queryFrustumUpdated(Query* query, const Frustum& old_frustum, const Frustum& new_frustum);
+    virtual void queryDeleted(const Query* query);
+
+private:
+    typedef std::set<ObjectID> IDSet;
+    typedef std::set<Object*> ObjectSet;
+
+    // The query's copy registered with the candidate, and both results
+    struct QueryState {
+        Query* candidate;
+        IDSet candidateResults;
+        IDSet referenceResults;
+    };
+    typedef std::map<Query*, QueryState*> QueryMap;
+
+    // Recomputes the reference result for the query at time t
+    void evaluateReference(Query* query, QueryState* state, const Time& t);
+    // Collects the candidate's events, delivering them to the query
+    void collectResults(Query* query, QueryState* state);
+    void compareResults(Query* query, QueryState* state, const Time& t);
+    void addDivergence(const Divergence& div);
+
+    QueryHandler* mCandidate;
+    ObjectSet mObjects;
+    QueryMap mQueries;
+    std::vector<Divergence> mDivergences;
+    uint32 mDivergenceCount;
+    uint32 mMaxRecorded;
+}; // class ValidatingQueryHandler
+
+} // namespace Prox
+
+#endif //_PROX_VALIDATING_QUERY_HANDLER_HPP_
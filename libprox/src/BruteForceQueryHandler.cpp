@@ -31,20 +31,183 @@
  */
 
 #include <prox/BruteForceQueryHandler.hpp>
+#include <prox/QueryConstraints.hpp>
 #include <prox/BoundingSphere.hpp>
+#include <prox/Timer.hpp>
 #include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <float.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
 
 namespace Prox {
 
+// How far tick times may drift from the epoch before positions are rebased
+static const float BruteForce_max_epoch_offset = 10.f;
+// Upper bound on validity intervals so they remain reasonably precise
+static const float BruteForce_max_validity_interval = 60.f;
+
+// Classification of an object against a query's thresholds
+enum BruteForceResult {
+    BruteForce_Outside = 0,
+    BruteForce_InsideExit = 1, // satisfies only the exit thresholds
+    BruteForce_InsideEntry = 2 // satisfies the entry, and therefore exit, thresholds
+};
+
+struct BruteForceObjectArrays {
+    const float* px;
+    const float* py;
+    const float* pz;
+    const float* vx;
+    const float* vy;
+    const float* vz;
+    const float* radius;
+    uint32 count;
+};
+
+struct BruteForceQueryParams {
+    float dt; // seconds since the epoch
+    float x, y, z;
+    float enter_radius_sq, exit_radius_sq;
+    // see SolidAngle::maxDistanceRatioSquared
+    float enter_angle_ratio, exit_angle_ratio;
+};
+
+static void BruteForce_classify_scalar(const BruteForceObjectArrays& objs, const BruteForceQueryParams& q, uint32 begin, uint8* results) {
+    for(uint32 i = begin; i < objs.count; i++) {
+        float dx = objs.px[i] + objs.vx[i] * q.dt - q.x;
+        float dy = objs.py[i] + objs.vy[i] * q.dt - q.y;
+        float dz = objs.pz[i] + objs.vz[i] * q.dt - q.z;
+        float dist_sq = dx*dx + dy*dy + dz*dz;
+
+        if (dist_sq <= q.enter_radius_sq && SolidAngle::satisfiesRatio(q.enter_angle_ratio, objs.radius[i], dist_sq))
+            results[i] = BruteForce_InsideEntry;
+        else if (dist_sq <= q.exit_radius_sq && SolidAngle::satisfiesRatio(q.exit_angle_ratio, objs.radius[i], dist_sq))
+            results[i] = BruteForce_InsideExit;
+        else
+            results[i] = BruteForce_Outside;
+    }
+}
+
+#ifdef __AVX__
+// Classifies objects 8 at a time, returning the index of the first object
+// which still needs to be handled by the scalar path
+static uint32 BruteForce_classify_avx(const BruteForceObjectArrays& objs, const BruteForceQueryParams& q, uint8* results) {
+    const __m256 dt = _mm256_set1_ps(q.dt);
+    const __m256 qx = _mm256_set1_ps(q.x);
+    const __m256 qy = _mm256_set1_ps(q.y);
+    const __m256 qz = _mm256_set1_ps(q.z);
+    const __m256 enter_radius_sq = _mm256_set1_ps(q.enter_radius_sq);
+    const __m256 exit_radius_sq = _mm256_set1_ps(q.exit_radius_sq);
+    const __m256 enter_angle_ratio = _mm256_set1_ps(q.enter_angle_ratio);
+    const __m256 exit_angle_ratio = _mm256_set1_ps(q.exit_angle_ratio);
+    // Lanes for which SolidAngle::satisfiesRatio short circuits, i.e. all or none
+    const __m256 max_ratio = _mm256_set1_ps(FLT_MAX);
+    const __m256 enter_any_angle = _mm256_cmp_ps(enter_angle_ratio, max_ratio, _CMP_EQ_OQ);
+    const __m256 exit_any_angle = _mm256_cmp_ps(exit_angle_ratio, max_ratio, _CMP_EQ_OQ);
+
+    uint32 i = 0;
+    for(; i + 8 <= objs.count; i += 8) {
+        __m256 dx = _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(objs.px + i), _mm256_mul_ps(_mm256_loadu_ps(objs.vx + i), dt)), qx);
+        __m256 dy = _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(objs.py + i), _mm256_mul_ps(_mm256_loadu_ps(objs.vy + i), dt)), qy);
+        __m256 dz = _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(objs.pz + i), _mm256_mul_ps(_mm256_loadu_ps(objs.vz + i), dt)), qz);
+        __m256 dist_sq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+        __m256 r = _mm256_loadu_ps(objs.radius + i);
+        __m256 r_sq = _mm256_mul_ps(r, r);
+
+        int enter_mask = _mm256_movemask_ps(_mm256_and_ps(
+                _mm256_cmp_ps(dist_sq, enter_radius_sq, _CMP_LE_OQ),
+                _mm256_or_ps(enter_any_angle, _mm256_cmp_ps(_mm256_mul_ps(r_sq, enter_angle_ratio), dist_sq, _CMP_GE_OQ))
+            ));
+        int exit_mask = _mm256_movemask_ps(_mm256_and_ps(
+                _mm256_cmp_ps(dist_sq, exit_radius_sq, _CMP_LE_OQ),
+                _mm256_or_ps(exit_any_angle, _mm256_cmp_ps(_mm256_mul_ps(r_sq, exit_angle_ratio), dist_sq, _CMP_GE_OQ))
+            ));
+
+        for(int j = 0; j < 8; j++) {
+            if (enter_mask & (1 << j))
+                results[i+j] = BruteForce_InsideEntry;
+            else if (exit_mask & (1 << j))
+                results[i+j] = BruteForce_InsideExit;
+            else
+                results[i+j] = BruteForce_Outside;
+        }
+    }
+    return i;
+}
+#endif
+
+static void BruteForce_classify(const BruteForceObjectArrays& objs, const BruteForceQueryParams& q, uint8* results) {
+    uint32 begin = 0;
+#ifdef __AVX__
+    begin = BruteForce_classify_avx(objs, q, results);
+#endif
+    BruteForce_classify_scalar(objs, q, begin, results);
+}
+
+// Computes how many seconds pass before any object could cross the query's
+// thresholds, given which objects are in the result.  Members can leave once
+// they are further than the exit threshold distance, min(sqrt(ratio)*r, R),
+// and non-members can enter once they are closer than the entry one, so the
+// interval is the smallest margin divided by the closing speed.  Intervals
+// shorter than min_interval are reported as 0, since the query will be
+// reevaluated before they end anyway, which lets the scan stop early.
+static float BruteForce_validity_interval(const BruteForceObjectArrays& objs, const BruteForceQueryParams& q, const Vector3f& qvel, const uint8* members, float min_interval) {
+    float enter_radius = sqrtf(q.enter_radius_sq), exit_radius = sqrtf(q.exit_radius_sq);
+
+    float interval = BruteForce_max_validity_interval;
+    for(uint32 i = 0; i < objs.count; i++) {
+        float rvx = objs.vx[i] - qvel.x, rvy = objs.vy[i] - qvel.y, rvz = objs.vz[i] - qvel.z;
+        float speed_sq = rvx*rvx + rvy*rvy + rvz*rvz;
+        if (speed_sq == 0.f)
+            continue;
+
+        float dx = objs.px[i] + objs.vx[i] * q.dt - q.x;
+        float dy = objs.py[i] + objs.vy[i] * q.dt - q.y;
+        float dz = objs.pz[i] + objs.vz[i] * q.dt - q.z;
+        float dist = sqrtf(dx*dx + dy*dy + dz*dz);
+
+        float margin;
+        if (members[i])
+            margin = std::min(SolidAngle::maxDistance(q.exit_angle_ratio, objs.radius[i]), exit_radius) - dist;
+        else
+            margin = dist - std::min(SolidAngle::maxDistance(q.enter_angle_ratio, objs.radius[i]), enter_radius);
+        if (margin <= 0.f)
+            return 0.f;
+
+        float speed = sqrtf(speed_sq);
+        if (margin < interval * speed)
+            interval = margin / speed;
+        if (interval < min_interval)
+            return 0.f;
+    }
+    return interval;
+}
+
+// See QueryConstraints_rank_key
+static float BruteForce_rank_key(const BruteForceObjectArrays& objs, const BruteForceQueryParams& q, Query::Ranking ranking, uint32 i) {
+    float dx = objs.px[i] + objs.vx[i] * q.dt - q.x;
+    float dy = objs.py[i] + objs.vy[i] * q.dt - q.y;
+    float dz = objs.pz[i] + objs.vz[i] * q.dt - q.z;
+    return QueryConstraints_rank_key(dx*dx + dy*dy + dz*dz, objs.radius[i], ranking);
+}
+
 BruteForceQueryHandler::BruteForceQueryHandler()
  : QueryHandler(),
    ObjectChangeListener(),
-   QueryChangeListener()
+   QueryChangeListener(),
+   mEpoch(0),
+   mLastTime(0),
+   mTickCount(1),
+   mValidityIntervals(true),
+   mMovingObjects(0)
 {
 }
 
 BruteForceQueryHandler::~BruteForceQueryHandler() {
-    mObjects.clear();
+    mObjectIndices.clear();
     for(QueryMap::iterator it = mQueries.begin(); it != mQueries.end(); it++) {
         QueryState* state = it->second;
         delete state;
@@ -53,65 +216,286 @@ BruteForceQueryHandler::~BruteForceQueryHandler() {
 }
 
 void BruteForceQueryHandler::registerObject(Object* obj) {
-    mObjects.insert(obj);
+    uint32 idx = mObjects.size();
+    mObjectIndices[obj] = idx;
+    mObjects.push_back(obj);
+    mObjectIDs.push_back(obj->id());
+    mPositionX.push_back(0.f); mPositionY.push_back(0.f); mPositionZ.push_back(0.f);
+    mVelocityX.push_back(0.f); mVelocityY.push_back(0.f); mVelocityZ.push_back(0.f);
+    mRadius.push_back(0.f);
+    storeObject(idx, obj);
+    mChangedObjects.insert(obj);
+    if (obj->position().velocity().lengthSquared() != 0.f)
+        mMovingObjects++;
     obj->addChangeListener(this);
 }
 
 void BruteForceQueryHandler::registerQuery(Query* query) {
     QueryState* state = new QueryState;
     mQueries[query] = state;
+    mScheduler.addQuery(query, mLastTime);
     query->addChangeListener(this);
 }
 
+bool BruteForceQueryHandler::validityIntervals() const {
+    return mValidityIntervals;
+}
+
+void BruteForceQueryHandler::validityIntervals(bool enabled) {
+    mValidityIntervals = enabled;
+}
+
+void BruteForceQueryHandler::storeObject(uint32 idx, const Object* obj) {
+    const MotionVector3f& motion = obj->position();
+    const BoundingSphere3f& bounds = obj->bounds();
+    Vector3f pos = motion.position(mEpoch) + bounds.center();
+    const Vector3f& vel = motion.velocity();
+
+    mObjectIDs[idx] = obj->id();
+    mPositionX[idx] = pos.x; mPositionY[idx] = pos.y; mPositionZ[idx] = pos.z;
+    mVelocityX[idx] = vel.x; mVelocityY[idx] = vel.y; mVelocityZ[idx] = vel.z;
+    mRadius[idx] = bounds.radius();
+}
+
+void BruteForceQueryHandler::markDirtyRegions(const Time& t) {
+    // Changed objects keep moving, so validity intervals must account for
+    // where they can get to
+    for(std::set<Object*>::iterator it = mChangedObjects.begin(); it != mChangedObjects.end(); it++)
+        mChangedRegions.mark( (*it)->worldBounds(mLastTime), (*it)->worldBounds(t), (*it)->position().velocity().length() );
+}
+
+void BruteForceQueryHandler::rebase(const Time& t) {
+    // Recompute from each object's motion vector rather than integrating the
+    // stored positions, so float error doesn't accumulate across rebases
+    mEpoch = t;
+    for(uint32 i = 0; i < mObjects.size(); i++)
+        storeObject(i, mObjects[i]);
+}
+
 void BruteForceQueryHandler::tick(const Time& t) {
-    for(QueryMap::iterator query_it = mQueries.begin(); query_it != mQueries.end(); query_it++) {
-        Query* query = query_it->first;
-        QueryState* state = query_it->second;
-        QueryCache newcache;
+    if ((t - mEpoch).seconds() > BruteForce_max_epoch_offset)
+        rebase(t);
 
-        for(ObjectSet::iterator obj_it = mObjects.begin(); obj_it != mObjects.end(); obj_it++) {
-            Object* obj = *obj_it;
+    mTickCount++;
+    markDirtyRegions(t);
 
-            // Must satisfy radius constraint
-            if (query->radius() != Query::InfiniteRadius && (obj->position(t)-query->position(t)).lengthSquared() > query->radius()*query->radius())
-                continue;
+    std::vector<Query*> due;
+    uint32 nrequired;
+    mScheduler.schedule(t, &due, &nrequired);
+    for(uint32 i = 0; i < due.size(); i++) {
+        QueryState* state = mQueries[due[i]];
+        if (unaffected(due[i], state, t)) {
+            state->exactTick = mTickCount;
+            mScheduler.evaluated(due[i], t, 0);
+            continue;
+        }
+        evaluateQuery(due[i], state, t);
+    }
+
+    mChangedRegions.clear();
+    mChangedObjects.clear();
+
+    mLastTime = t;
+}
+
+void BruteForceQueryHandler::tick(const Time& t, const Duration& budget) {
+    Timer timer;
+    timer.start();
 
-            // Must satisfy solid angle constraint
-            BoundingSphere3f bs = obj->bounds();
-            Vector3f obj_pos = obj->position(t) + bs.center();
-            Vector3f to_obj = obj_pos - query->position(t);
-            SolidAngle solid_angle = SolidAngle::fromCenterRadius(to_obj, bs.radius());
+    if ((t - mEpoch).seconds() > BruteForce_max_epoch_offset)
+        rebase(t);
 
-            if (solid_angle < query->angle())
-                continue;
+    // Queries about to exceed their maximum staleness are always refreshed,
+    // the rest in priority order while the budget lasts
+    mTickCount++;
+    markDirtyRegions(t);
 
-            newcache.add(obj->id());
+    std::vector<Query*> due;
+    uint32 nrequired;
+    mScheduler.schedule(t, &due, &nrequired);
+    for(uint32 i = 0; i < due.size(); i++) {
+        if (i >= nrequired && i > 0 && !(timer.elapsed() < budget))
+            break;
+        QueryState* state = mQueries[due[i]];
+        if (unaffected(due[i], state, t)) {
+            state->exactTick = mTickCount;
+            mScheduler.evaluated(due[i], t, 0);
+            continue;
         }
+        evaluateQuery(due[i], state, t);
+    }
+
+    mChangedRegions.clear();
+    mChangedObjects.clear();
 
-        std::deque<QueryEvent> events;
-        state->cache.exchange(newcache, &events);
+    mLastTime = t;
+}
+
+Duration BruteForceQueryHandler::staleness(const Query* query, const Time& t) const {
+    return mScheduler.staleness(query, t);
+}
 
-        query->pushEvents(events);
+bool BruteForceQueryHandler::unaffected(Query* query, QueryState* state, const Time& t) const {
+    // the cached result must have been exact as of the last tick
+    if (state->exactTick + 1 != mTickCount)
+        return false;
+
+    const MotionVector3f& qmotion = query->position();
+    float qradius = query->exitRadius();
+    float qangle_ratio = query->exitAngle().maxDistanceRatioSquared();
+
+    // If nothing is moving, a stationary query only needs to worry about
+    // nearby changes
+    if (mMovingObjects == 0 && qmotion.velocity().lengthSquared() == 0.f &&
+        !mChangedRegions.affects(qmotion.position(), qradius, qangle_ratio))
+        return true;
+
+    // Within the validity interval motion can't change the result, only
+    // objects whose motion changed, and where they could reach before it ends
+    if (mValidityIntervals && t < state->safeUntil) {
+        float remaining = (state->safeUntil - t).seconds();
+        return !mChangedRegions.affects(qmotion.position(t), qradius, qangle_ratio, qmotion.velocity().length(), remaining);
     }
+
+    return false;
+}
+
+void BruteForceQueryHandler::evaluateQuery(Query* query, QueryState* state, const Time& t) {
+    BruteForceObjectArrays objs;
+    objs.count = mObjects.size();
+    if (objs.count > 0) {
+        objs.px = &mPositionX[0]; objs.py = &mPositionY[0]; objs.pz = &mPositionZ[0];
+        objs.vx = &mVelocityX[0]; objs.vy = &mVelocityY[0]; objs.vz = &mVelocityZ[0];
+        objs.radius = &mRadius[0];
+    }
+    mResults.resize(objs.count);
+
+    QueryCache newcache;
+
+    Vector3f qpos = query->position(t);
+    BruteForceQueryParams params;
+    params.dt = (t - mEpoch).seconds();
+    params.x = qpos.x; params.y = qpos.y; params.z = qpos.z;
+    params.enter_radius_sq = (query->radius() == Query::InfiniteRadius) ? FLT_MAX : query->radius() * query->radius();
+    params.exit_radius_sq = (query->exitRadius() == Query::InfiniteRadius) ? FLT_MAX : query->exitRadius() * query->exitRadius();
+    params.enter_angle_ratio = query->angle().maxDistanceRatioSquared();
+    params.exit_angle_ratio = query->exitAngle().maxDistanceRatioSquared();
+
+    if (objs.count > 0)
+        BruteForce_classify(objs, params, &mResults[0]);
+
+    uint32 max_results = query->maxResults();
+    Query::Ranking ranking = query->ranking();
+    const Frustum& qfrustum = query->frustum();
+    std::vector<RankedObject> ranked;
+    for(uint32 i = 0; i < objs.count; i++) {
+        // Objects already in the result only need to satisfy the exit thresholds
+        bool member = (mResults[i] == BruteForce_InsideEntry ||
+            (mResults[i] == BruteForce_InsideExit && state->cache.contains(mObjectIDs[i])));
+        // The frustum is only tested for the few objects which pass the
+        // thresholds
+        if (member && !qfrustum.unbounded()) {
+            Vector3f opos(mPositionX[i] + mVelocityX[i] * params.dt, mPositionY[i] + mVelocityY[i] * params.dt, mPositionZ[i] + mVelocityZ[i] * params.dt);
+            member = qfrustum.intersects(qpos, BoundingSphere3f(opos, mRadius[i]));
+        }
+        if (member) {
+            if (max_results == 0)
+                newcache.add(mObjectIDs[i]);
+            else
+                ranked.push_back( RankedObject(BruteForce_rank_key(objs, params, ranking, i), mObjectIDs[i]) );
+        }
+        mResults[i] = member ? 1 : 0;
+    }
+
+    if (max_results != 0) {
+        if (ranked.size() > max_results) {
+            std::nth_element(ranked.begin(), ranked.begin() + max_results, ranked.end(), QueryConstraints_ranks_before);
+            ranked.erase(ranked.begin() + max_results, ranked.end());
+        }
+        for(uint32 i = 0; i < ranked.size(); i++)
+            newcache.add(ranked[i].id);
+    }
+
+    if (mValidityIntervals) {
+        // Limited results can change as objects are reordered without any of
+        // them crossing a threshold, and objects can cross frustum planes, so
+        // neither gets a validity interval
+        float interval = 0.f;
+        if (max_results == 0 && qfrustum.unbounded())
+            interval = (objs.count > 0) ? BruteForce_validity_interval(objs, params, query->position().velocity(), &mResults[0], (t - mLastTime).seconds()) : BruteForce_max_validity_interval;
+        state->safeUntil = t + Duration::seconds(interval);
+    }
+
+    std::deque<QueryEvent> events;
+    state->cache.exchange(newcache, &events);
+    mScheduler.evaluated(query, t, events.size());
+    state->exactTick = mTickCount;
+
+    query->pushEvents(events);
 }
 
 void BruteForceQueryHandler::objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos) {
-    // Nothing to be done, we use values directly from the object
+    ObjectIndexMap::iterator where = mObjectIndices.find(obj);
+    assert( where != mObjectIndices.end() );
+    const BoundingSphere3f& bounds = obj->bounds();
+    mChangedRegions.mark( BoundingSphere3f(old_pos.position(mLastTime) + bounds.center(), bounds.radius()) );
+    mChangedObjects.insert(obj);
+    if (old_pos.velocity().lengthSquared() != 0.f)
+        mMovingObjects--;
+    if (new_pos.velocity().lengthSquared() != 0.f)
+        mMovingObjects++;
+    storeObject(where->second, obj);
 }
 
 void BruteForceQueryHandler::objectBoundingSphereUpdated(Object* obj, const BoundingSphere3f& old_bounds, const BoundingSphere3f& new_bounds) {
-    // Nothing to be done, we use values directly from the object
+    ObjectIndexMap::iterator where = mObjectIndices.find(obj);
+    assert( where != mObjectIndices.end() );
+    mChangedRegions.mark( BoundingSphere3f(obj->position(mLastTime) + old_bounds.center(), old_bounds.radius()) );
+    mChangedObjects.insert(obj);
+    storeObject(where->second, obj);
 }
 
 void BruteForceQueryHandler::objectDeleted(const Object* obj) {
-    ObjectSet::iterator where=mObjects.find(const_cast<Object*>(obj));
-    assert( where != mObjects.end() );
-    (*where)->removeChangeListener(this);
-    mObjects.erase(where);
+    ObjectIndexMap::iterator where = mObjectIndices.find(obj);
+    assert( where != mObjectIndices.end() );
+    mChangedRegions.mark( obj->worldBounds(mLastTime) );
+    mChangedObjects.erase(const_cast<Object*>(obj));
+    if (obj->position().velocity().lengthSquared() != 0.f)
+        mMovingObjects--;
+    uint32 idx = where->second;
+    mObjectIndices.erase(where);
+    mObjects[idx]->removeChangeListener(this);
+
+    uint32 last = mObjects.size() - 1;
+    if (idx != last) {
+        mObjects[idx] = mObjects[last];
+        mObjectIDs[idx] = mObjectIDs[last];
+        mPositionX[idx] = mPositionX[last]; mPositionY[idx] = mPositionY[last]; mPositionZ[idx] = mPositionZ[last];
+        mVelocityX[idx] = mVelocityX[last]; mVelocityY[idx] = mVelocityY[last]; mVelocityZ[idx] = mVelocityZ[last];
+        mRadius[idx] = mRadius[last];
+        mObjectIndices[mObjects[idx]] = idx;
+    }
+    mObjects.pop_back();
+    mObjectIDs.pop_back();
+    mPositionX.pop_back(); mPositionY.pop_back(); mPositionZ.pop_back();
+    mVelocityX.pop_back(); mVelocityY.pop_back(); mVelocityZ.pop_back();
+    mRadius.pop_back();
 }
 
 void BruteForceQueryHandler::queryPositionUpdated(Query* query, const MotionVector3f& old_pos, const MotionVector3f& new_pos) {
-    // Nothing to be done, we use values directly from the query
+    // Positions are used directly from the query, but the cached result can
+    // no longer be assumed exact
+    QueryMap::iterator it = mQueries.find(query);
+    assert( it != mQueries.end() );
+    it->second->exactTick = 0;
+    it->second->safeUntil = Time(0);
+}
+
+void BruteForceQueryHandler::queryFrustumUpdated(Query* query, const Frustum& old_frustum, const Frustum& new_frustum) {
+    QueryMap::iterator it = mQueries.find(query);
+    assert( it != mQueries.end() );
+    it->second->exactTick = 0;
+    it->second->safeUntil = Time(0);
 }
 
 void BruteForceQueryHandler::queryDeleted(const Query* query) {
@@ -120,6 +504,7 @@ void BruteForceQueryHandler::queryDeleted(const Query* query) {
     QueryState* state = it->second;
     delete state;
     mQueries.erase(it);
+    mScheduler.removeQuery(query);
 }
 
 } // namespace Prox
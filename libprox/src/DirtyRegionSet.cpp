@@ -0,0 +1,134 @@
+/*  libprox
+ *  DirtyRegionSet.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <prox/DirtyRegionSet.hpp>
+#include <prox/Query.hpp>
+#include <algorithm>
+#include <float.h>
+
+namespace Prox {
+
+// Past this many regions new ones are merged into existing ones
+static const uint32 DirtyRegionSet_max_regions = 64;
+
+// Smallest sphere containing both spheres.  Unlike BoundingSphere::merge this
+// handles degenerate spheres, which point objects produce.
+static BoundingSphere3f DirtyRegionSet_merge(const BoundingSphere3f& a, const BoundingSphere3f& b) {
+    Vector3f to_b = b.center() - a.center();
+    float dist = to_b.length();
+    if (dist + b.radius() <= a.radius())
+        return a;
+    if (dist + a.radius() <= b.radius())
+        return b;
+    float radius = (dist + a.radius() + b.radius()) * 0.5f;
+    return BoundingSphere3f(a.center() + to_b * ((radius - a.radius()) / dist), radius);
+}
+
+DirtyRegionSet::DirtyRegionSet()
+ : mAll(false)
+{
+}
+
+DirtyRegionSet::~DirtyRegionSet() {
+}
+
+void DirtyRegionSet::mark(const BoundingSphere3f& region, float speed) {
+    if (mAll) return;
+
+    if (mRegions.size() < DirtyRegionSet_max_regions) {
+        mRegions.push_back(region);
+        mSpeeds.push_back(speed);
+        return;
+    }
+
+    // Coarsen the set instead of giving up on it, growing whichever region
+    // needs to grow least to cover the new one
+    uint32 best = 0;
+    float best_growth = FLT_MAX;
+    for(uint32 i = 0; i < mRegions.size(); i++) {
+        float growth = DirtyRegionSet_merge(mRegions[i], region).radius() - mRegions[i].radius();
+        if (growth < best_growth) {
+            best = i;
+            best_growth = growth;
+        }
+    }
+    mRegions[best] = DirtyRegionSet_merge(mRegions[best], region);
+    mSpeeds[best] = std::max(mSpeeds[best], speed);
+}
+
+void DirtyRegionSet::mark(const BoundingSphere3f& from, const BoundingSphere3f& to, float speed) {
+    // BoundingSphere::merge ignores degenerate spheres, so merge centers
+    // explicitly to cover point objects
+    Vector3f center = (from.center() + to.center()) * 0.5f;
+    float radius = (to.center() - from.center()).length() * 0.5f + std::max(from.radius(), to.radius());
+    mark( BoundingSphere3f(center, radius), speed );
+}
+
+void DirtyRegionSet::markAll() {
+    mAll = true;
+    mRegions.clear();
+    mSpeeds.clear();
+}
+
+void DirtyRegionSet::clear() {
+    mAll = false;
+    mRegions.clear();
+    mSpeeds.clear();
+}
+
+bool DirtyRegionSet::affects(const Vector3f& qpos, float qradius, float qangle_ratio, float qspeed, float duration) const {
+    if (mAll) return true;
+
+    for(uint32 i = 0; i < mRegions.size(); i++) {
+        const BoundingSphere3f& region = mRegions[i];
+        float dist_sq = (region.center() - qpos).lengthSquared();
+        // Growing the region by the relative distance travelled covers both the
+        // objects' and the query's motion
+        float r = region.radius() + (mSpeeds[i] + qspeed) * duration;
+
+        // Queries inside a region could see anything in it
+        if (dist_sq <= r * r)
+            return true;
+        // Any object in the region is at most r further than its center
+        if (qradius != Query::InfiniteRadius && dist_sq > (qradius + r) * (qradius + r))
+            continue;
+        // and can't subtend a larger angle than the region itself
+        if (!SolidAngle::satisfiesRatio(qangle_ratio, r, dist_sq))
+            continue;
+
+        return true;
+    }
+
+    return false;
+}
+
+} // namespace Prox
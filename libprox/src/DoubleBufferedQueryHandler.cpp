@@ -0,0 +1,216 @@
+/*  libprox
+ *  DoubleBufferedQueryHandler.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <prox/DoubleBufferedQueryHandler.hpp>
+#include <cstring>
+
+namespace Prox {
+
+DoubleBufferedQueryHandler::DoubleBufferedQueryHandler(QueryHandler* inner)
+ : QueryHandler(),
+   ObjectChangeListener(),
+   mInner(inner),
+   mOverflowing(false)
+{
+}
+
+DoubleBufferedQueryHandler::~DoubleBufferedQueryHandler() {
+    // Objects which haven't been deleted, including those only registered
+    // since the last tick, still have us as a listener
+    drainUpdates();
+    std::set<const Object*> live;
+    for(ObjectCopyMap::iterator it = mObjectCopies.begin(); it != mObjectCopies.end(); it++)
+        live.insert(it->first);
+    for(PendingObjectMap::iterator it = mPending.begin(); it != mPending.end(); it++) {
+        if (it->second.present)
+            live.insert(it->first);
+        else
+            live.erase(it->first);
+    }
+    for(std::set<const Object*>::iterator it = live.begin(); it != live.end(); it++)
+        const_cast<Object*>(*it)->removeChangeListener(this);
+
+    // The copies notify the inner handler as they're deleted, so it must
+    // outlive them
+    for(ObjectCopyMap::iterator it = mObjectCopies.begin(); it != mObjectCopies.end(); it++)
+        delete it->second;
+    mObjectCopies.clear();
+
+    delete mInner;
+}
+
+void DoubleBufferedQueryHandler::registerObject(Object* obj) {
+    pushUpdate(ObjectUpdate::Registered, obj, obj->position(), obj->bounds());
+    obj->addChangeListener(this);
+}
+
+void DoubleBufferedQueryHandler::registerQuery(Query* query) {
+    mInner->registerQuery(query);
+}
+
+void DoubleBufferedQueryHandler::tick(const Time& t) {
+    applyUpdates();
+    mInner->tick(t);
+}
+
+void DoubleBufferedQueryHandler::tick(const Time& t, const Duration& budget) {
+    applyUpdates();
+    mInner->tick(t, budget);
+}
+
+Duration DoubleBufferedQueryHandler::staleness(const Query* query, const Time& t) const {
+    return mInner->staleness(query, t);
+}
+
+void DoubleBufferedQueryHandler::pushUpdate(ObjectUpdate::Type type, const Object* obj, const MotionVector3f& pos, const BoundingSphere3f& bounds) {
+    ObjectUpdate update;
+    update.type = type;
+    update.object = obj;
+    std::memcpy(update.id, obj->id().begin(), ObjectID::static_size);
+    update.time = pos.updateTime().microseconds();
+    update.position[0] = pos.position().x; update.position[1] = pos.position().y; update.position[2] = pos.position().z;
+    update.velocity[0] = pos.velocity().x; update.velocity[1] = pos.velocity().y; update.velocity[2] = pos.velocity().z;
+    update.center[0] = bounds.center().x; update.center[1] = bounds.center().y; update.center[2] = bounds.center().z;
+    update.radius = bounds.radius();
+
+    if (!mOverflowing.load() && mUpdateQueue.push(update))
+        return;
+
+    boost::mutex::scoped_lock lock(mOverflowMutex);
+    mOverflowing.store(true);
+    mOverflow.push_back(update);
+}
+
+void DoubleBufferedQueryHandler::mergeUpdate(const ObjectUpdate& update) {
+    PendingObject& pending = mPending[update.object];
+    pending.id = ObjectID(update.id, ObjectID::static_size);
+    pending.position = MotionVector3f(
+        Time(update.time),
+        Vector3f(update.position[0], update.position[1], update.position[2]),
+        Vector3f(update.velocity[0], update.velocity[1], update.velocity[2])
+    );
+    pending.bounds = BoundingSphere3f(Vector3f(update.center[0], update.center[1], update.center[2]), update.radius);
+    switch(update.type) {
+      case ObjectUpdate::Registered:
+        pending.present = true;
+        pending.added = true;
+        break;
+      case ObjectUpdate::Moved:
+        pending.moved = true;
+        break;
+      case ObjectUpdate::Resized:
+        break;
+      case ObjectUpdate::Deleted:
+        pending.present = false;
+        pending.added = false;
+        break;
+    }
+}
+
+void DoubleBufferedQueryHandler::drainUpdates() {
+    // Updates from a single producer come out in the order they were pushed,
+    // so merging them in order leaves each object's latest state.  A producer
+    // only uses the overflow list after the queue filled, so its queued
+    // updates all precede its overflowed ones.
+    ObjectUpdate update;
+    while(mUpdateQueue.pop(update))
+        mergeUpdate(update);
+
+    std::vector<ObjectUpdate> overflow;
+    {
+        boost::mutex::scoped_lock lock(mOverflowMutex);
+        overflow.swap(mOverflow);
+        mOverflowing.store(false);
+    }
+    for(std::size_t i = 0; i < overflow.size(); i++)
+        mergeUpdate(overflow[i]);
+}
+
+void DoubleBufferedQueryHandler::applyUpdates() {
+    drainUpdates();
+
+    // Position updates are applied as a single batch so the inner handler
+    // can restructure its index once
+    std::vector<Object*> moved;
+    std::vector<MotionVector3f> moved_positions;
+    for(PendingObjectMap::iterator it = mPending.begin(); it != mPending.end(); it++) {
+        const PendingObject& pending = it->second;
+        ObjectCopyMap::iterator copy_it = mObjectCopies.find(it->first);
+
+        if (copy_it != mObjectCopies.end() && (!pending.present || pending.added)) {
+            delete copy_it->second;
+            mObjectCopies.erase(copy_it);
+            copy_it = mObjectCopies.end();
+        }
+        if (!pending.present)
+            continue;
+
+        if (copy_it == mObjectCopies.end()) {
+            Object* copy = new Object(pending.id, pending.position, pending.bounds);
+            mObjectCopies[it->first] = copy;
+            mInner->registerObject(copy);
+            continue;
+        }
+
+        Object* copy = copy_it->second;
+        if (copy->bounds().center() != pending.bounds.center() || copy->bounds().radius() != pending.bounds.radius())
+            copy->bounds(pending.bounds);
+        if (pending.moved) {
+            moved.push_back(copy);
+            moved_positions.push_back(pending.position);
+        }
+    }
+    mPending.clear();
+
+    if (!moved.empty())
+        Object::updatePositions(&moved[0], &moved_positions[0], moved.size());
+}
+
+void DoubleBufferedQueryHandler::objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos) {
+    pushUpdate(ObjectUpdate::Moved, obj, new_pos, obj->bounds());
+}
+
+void DoubleBufferedQueryHandler::objectsPositionUpdated(const ObjectPositionUpdate* updates, std::size_t count) {
+    for(std::size_t i = 0; i < count; i++)
+        pushUpdate(ObjectUpdate::Moved, updates[i].object, updates[i].new_pos, updates[i].object->bounds());
+}
+
+void DoubleBufferedQueryHandler::objectBoundingSphereUpdated(Object* obj, const BoundingSphere3f& old_bounds, const BoundingSphere3f& new_bounds) {
+    pushUpdate(ObjectUpdate::Resized, obj, obj->position(), new_bounds);
+}
+
+void DoubleBufferedQueryHandler::objectDeleted(const Object* obj) {
+    pushUpdate(ObjectUpdate::Deleted, obj, obj->position(), obj->bounds());
+    const_cast<Object*>(obj)->removeChangeListener(this);
+}
+
+} // namespace Prox
@@ -72,6 +72,10 @@ float Duration::milliseconds() const {
     return static_cast<float>(mMicrosecs) / 1000.f;
 }
 
+int64 Duration::microseconds() const {
+    return mMicrosecs;
+}
+
 Duration Duration::operator+(const Duration& rhs) const {
     return Duration(mMicrosecs + rhs.mMicrosecs);
 }
@@ -0,0 +1,122 @@
+/*  libprox
+ *  Frustum.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <prox/Frustum.hpp>
+#include <cassert>
+#include <cmath>
+
+namespace Prox {
+
+Frustum::Frustum()
+ : mPlaneCount(0)
+{
+}
+
+Frustum::Frustum(const Quaternion& orientation, float fov, float aspect, float near_dist, float far_dist)
+ : mPlaneCount(MaxPlanes)
+{
+    assert( fov > 0.f && fov < 3.14159265f );
+    assert( near_dist >= 0.f && far_dist > near_dist );
+
+    Vector3f right = orientation.xAxis();
+    Vector3f up = orientation.yAxis();
+    Vector3f forward = -orientation.zAxis();
+
+    float half_fov_y = fov * 0.5f;
+    float half_fov_x = atan( tan(half_fov_y) * aspect );
+
+    // near and far
+    mNormals[0] = -forward; mOffsets[0] = -near_dist;
+    mNormals[1] = forward; mOffsets[1] = far_dist;
+    // the sides pass through the apex, with normals tilted back from the
+    // side directions by the half angles
+    mNormals[2] = right * cos(half_fov_x) - forward * sin(half_fov_x); mOffsets[2] = 0.f;
+    mNormals[3] = -right * cos(half_fov_x) - forward * sin(half_fov_x); mOffsets[3] = 0.f;
+    mNormals[4] = up * cos(half_fov_y) - forward * sin(half_fov_y); mOffsets[4] = 0.f;
+    mNormals[5] = -up * cos(half_fov_y) - forward * sin(half_fov_y); mOffsets[5] = 0.f;
+}
+
+Frustum::Frustum(const Frustum& cpy) {
+    *this = cpy;
+}
+
+Frustum::~Frustum() {
+}
+
+Frustum& Frustum::operator=(const Frustum& rhs) {
+    mPlaneCount = rhs.mPlaneCount;
+    for(int i = 0; i < mPlaneCount; i++) {
+        mNormals[i] = rhs.mNormals[i];
+        mOffsets[i] = rhs.mOffsets[i];
+    }
+    return *this;
+}
+
+bool Frustum::unbounded() const {
+    return (mPlaneCount == 0);
+}
+
+int Frustum::planeCount() const {
+    return mPlaneCount;
+}
+
+const Vector3f& Frustum::planeNormal(int i) const {
+    assert( i < mPlaneCount );
+    return mNormals[i];
+}
+
+float Frustum::planeOffset(int i) const {
+    assert( i < mPlaneCount );
+    return mOffsets[i];
+}
+
+Frustum Frustum::fromPlanes(int count, const Vector3f* normals, const float* offsets) {
+    assert( count >= 0 && count <= MaxPlanes );
+    Frustum result;
+    result.mPlaneCount = count;
+    for(int i = 0; i < count; i++) {
+        result.mNormals[i] = normals[i];
+        result.mOffsets[i] = offsets[i];
+    }
+    return result;
+}
+
+bool Frustum::intersects(const Vector3f& eye, const BoundingSphere3f& bounds) const {
+    Vector3f to_center = bounds.center() - eye;
+    for(int i = 0; i < mPlaneCount; i++) {
+        if (mNormals[i].dot(to_center) - mOffsets[i] > bounds.radius())
+            return false;
+    }
+    return true;
+}
+
+} // namespace Prox
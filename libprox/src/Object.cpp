@@ -86,6 +86,22 @@ void Object::position(const MotionVector3f& new_pos) {
         (*it)->objectPositionUpdated(this, old_pos, new_pos);
 }
 
+void Object::updatePositions(Object** objs, const MotionVector3f* new_pos, std::size_t count) {
+    typedef std::map<ObjectChangeListener*, std::vector<ObjectPositionUpdate> > ListenerUpdateMap;
+    ListenerUpdateMap listener_updates;
+
+    for(std::size_t i = 0; i < count; i++) {
+        Object* obj = objs[i];
+        ObjectPositionUpdate update(obj, obj->mPosition, new_pos[i]);
+        obj->mPosition = new_pos[i];
+        for(ChangeListenerList::iterator it = obj->mChangeListeners.begin(); it != obj->mChangeListeners.end(); it++)
+            listener_updates[*it].push_back(update);
+    }
+
+    for(ListenerUpdateMap::iterator it = listener_updates.begin(); it != listener_updates.end(); it++)
+        it->first->objectsPositionUpdated(&(it->second[0]), it->second.size());
+}
+
 void Object::bounds(const BoundingSphere3f& new_bounds) {
     BoundingSphere3f old_bounds = mBounds;
     mBounds = new_bounds;
@@ -0,0 +1,262 @@
+/*  libprox
+ *  Protocol.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <prox/Protocol.hpp>
+#include <cstring>
+
+namespace Prox {
+
+enum ProtocolMessageType {
+    Protocol_ObjectUpdated = 1,
+    Protocol_ObjectRemoved = 2,
+    Protocol_ObjectMigrated = 3,
+    Protocol_QueryEvents = 4
+};
+
+// Size of the length prefix at the start of each frame
+static const std::size_t Protocol_header_size = 4;
+
+ProtocolWriter::ProtocolWriter() {
+    clear();
+}
+
+ProtocolWriter::~ProtocolWriter() {
+}
+
+void ProtocolWriter::objectUpdated(const ObjectID& id, const MotionVector3f& pos, const BoundingSphere3f& bounds) {
+    writeObject(Protocol_ObjectUpdated, id, pos, bounds);
+}
+
+void ProtocolWriter::objectRemoved(const ObjectID& id) {
+    writeUInt8(Protocol_ObjectRemoved);
+    writeID(id);
+}
+
+void ProtocolWriter::objectMigrated(const ObjectID& id, const MotionVector3f& pos, const BoundingSphere3f& bounds) {
+    writeObject(Protocol_ObjectMigrated, id, pos, bounds);
+}
+
+void ProtocolWriter::queryEvents(uint32 query, const std::deque<QueryEvent>& events) {
+    writeUInt8(Protocol_QueryEvents);
+    writeUInt32(query);
+    writeUInt32(events.size());
+    for(std::deque<QueryEvent>::const_iterator it = events.begin(); it != events.end(); it++) {
+        writeUInt8(it->type() == QueryEvent::Added ? 1 : 0);
+        writeID(it->id());
+    }
+}
+
+bool ProtocolWriter::empty() const {
+    return mBuffer.size() == Protocol_header_size;
+}
+
+const std::vector<uint8>& ProtocolWriter::frame() {
+    uint32 len = mBuffer.size() - Protocol_header_size;
+    for(std::size_t i = 0; i < 4; i++)
+        mBuffer[i] = (uint8)(len >> (8*i));
+    return mBuffer;
+}
+
+void ProtocolWriter::clear() {
+    mBuffer.assign(Protocol_header_size, 0);
+}
+
+void ProtocolWriter::writeObject(uint8 type, const ObjectID& id, const MotionVector3f& pos, const BoundingSphere3f& bounds) {
+    writeUInt8(type);
+    writeID(id);
+    writeUInt64(pos.updateTime().microseconds());
+    writeVector(pos.position());
+    writeVector(pos.velocity());
+    writeVector(bounds.center());
+    writeFloat(bounds.radius());
+}
+
+void ProtocolWriter::writeUInt8(uint8 v) {
+    mBuffer.push_back(v);
+}
+
+void ProtocolWriter::writeUInt32(uint32 v) {
+    for(std::size_t i = 0; i < 4; i++)
+        mBuffer.push_back( (uint8)(v >> (8*i)) );
+}
+
+void ProtocolWriter::writeUInt64(uint64 v) {
+    for(std::size_t i = 0; i < 8; i++)
+        mBuffer.push_back( (uint8)(v >> (8*i)) );
+}
+
+void ProtocolWriter::writeFloat(float v) {
+    uint32 bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    writeUInt32(bits);
+}
+
+void ProtocolWriter::writeVector(const Vector3f& v) {
+    writeFloat(v.x);
+    writeFloat(v.y);
+    writeFloat(v.z);
+}
+
+void ProtocolWriter::writeID(const ObjectID& id) {
+    const uint8* data = (const uint8*)id.begin();
+    mBuffer.insert(mBuffer.end(), data, data + ObjectID::static_size);
+}
+
+
+ProtocolReader::ProtocolReader()
+ : mOffset(0),
+   mFrameEnd(0)
+{
+}
+
+ProtocolReader::~ProtocolReader() {
+}
+
+void ProtocolReader::append(const uint8* data, std::size_t len) {
+    mBuffer.insert(mBuffer.end(), data, data + len);
+}
+
+bool ProtocolReader::dispatch(ProtocolListener* listener) {
+    mOffset = 0;
+    bool valid = true;
+    while(valid && mBuffer.size() - mOffset >= Protocol_header_size) {
+        uint32 len = 0;
+        for(std::size_t i = 0; i < 4; i++)
+            len |= ((uint32)mBuffer[mOffset + i]) << (8*i);
+        if (mBuffer.size() - mOffset - Protocol_header_size < len)
+            break;
+        mOffset += Protocol_header_size;
+        mFrameEnd = mOffset + len;
+
+        while(valid && mOffset < mFrameEnd) {
+            uint8 type;
+            ObjectID id = ObjectID::null();
+            MotionVector3f pos(Time(0), Vector3f(0, 0, 0), Vector3f(0, 0, 0));
+            BoundingSphere3f bounds;
+            valid = readUInt8(&type);
+            if (!valid) break;
+
+            switch(type) {
+              case Protocol_ObjectUpdated:
+                valid = readObject(&id, &pos, &bounds);
+                if (valid) listener->objectUpdated(id, pos, bounds);
+                break;
+              case Protocol_ObjectRemoved:
+                valid = readID(&id);
+                if (valid) listener->objectRemoved(id);
+                break;
+              case Protocol_ObjectMigrated:
+                valid = readObject(&id, &pos, &bounds);
+                if (valid) listener->objectMigrated(id, pos, bounds);
+                break;
+              case Protocol_QueryEvents:
+                {
+                    uint32 query, count;
+                    valid = readUInt32(&query) && readUInt32(&count);
+                    std::deque<QueryEvent> events;
+                    for(uint32 i = 0; valid && i < count; i++) {
+                        uint8 added;
+                        valid = readUInt8(&added) && readID(&id);
+                        if (valid) events.push_back( QueryEvent(added ? QueryEvent::Added : QueryEvent::Removed, id) );
+                    }
+                    if (valid) listener->queryEventsReceived(query, events);
+                }
+                break;
+              default:
+                valid = false;
+                break;
+            }
+        }
+    }
+
+    mBuffer.erase(mBuffer.begin(), mBuffer.begin() + mOffset);
+    mOffset = 0;
+    return valid;
+}
+
+bool ProtocolReader::readUInt8(uint8* v) {
+    if (mFrameEnd - mOffset < 1)
+        return false;
+    *v = mBuffer[mOffset++];
+    return true;
+}
+
+bool ProtocolReader::readUInt32(uint32* v) {
+    if (mFrameEnd - mOffset < 4)
+        return false;
+    *v = 0;
+    for(std::size_t i = 0; i < 4; i++)
+        *v |= ((uint32)mBuffer[mOffset++]) << (8*i);
+    return true;
+}
+
+bool ProtocolReader::readUInt64(uint64* v) {
+    if (mFrameEnd - mOffset < 8)
+        return false;
+    *v = 0;
+    for(std::size_t i = 0; i < 8; i++)
+        *v |= ((uint64)mBuffer[mOffset++]) << (8*i);
+    return true;
+}
+
+bool ProtocolReader::readFloat(float* v) {
+    uint32 bits;
+    if (!readUInt32(&bits))
+        return false;
+    std::memcpy(v, &bits, sizeof(bits));
+    return true;
+}
+
+bool ProtocolReader::readVector(Vector3f* v) {
+    return readFloat(&v->x) && readFloat(&v->y) && readFloat(&v->z);
+}
+
+bool ProtocolReader::readID(ObjectID* id) {
+    if (mFrameEnd - mOffset < ObjectID::static_size)
+        return false;
+    *id = ObjectID(&mBuffer[mOffset], ObjectID::static_size);
+    mOffset += ObjectID::static_size;
+    return true;
+}
+
+bool ProtocolReader::readObject(ObjectID* id, MotionVector3f* pos, BoundingSphere3f* bounds) {
+    uint64 t;
+    Vector3f start, vel, center;
+    float radius;
+    if (!(readID(id) && readUInt64(&t) && readVector(&start) && readVector(&vel) && readVector(&center) && readFloat(&radius)))
+        return false;
+    *pos = MotionVector3f(Time(t), start, vel);
+    *bounds = BoundingSphere3f(center, radius);
+    return true;
+}
+
+} // namespace Prox
@@ -35,6 +35,7 @@
 #include <prox/QueryEventListener.hpp>
 #include <float.h>
 #include <algorithm>
+#include <cassert>
 
 namespace Prox {
 
@@ -44,8 +45,15 @@ Query::Query(const MotionVector3f& pos, const SolidAngle& minAngle)
  : mPosition(pos),
    mMinSolidAngle(minAngle),
    mMaxRadius(InfiniteRadius),
+   mExitSolidAngle(minAngle),
+   mExitRadius(InfiniteRadius),
+   mMaxStaleness(0),
+   mMaxResults(0),
+   mRanking(LargestSolidAngle),
+   mFrustum(),
    mChangeListeners(),
    mEventListener(NULL),
+   mCoalesceEvents(false),
    mNotified(false)
 {
 }
@@ -54,6 +62,15 @@ Query::Query(const MotionVector3f& pos, const SolidAngle& minAngle, float radius
  : mPosition(pos),
    mMinSolidAngle(minAngle),
    mMaxRadius(radius),
+   mExitSolidAngle(minAngle),
+   mExitRadius(radius),
+   mMaxStaleness(0),
+   mMaxResults(0),
+   mRanking(LargestSolidAngle),
+   mFrustum(),
+   mChangeListeners(),
+   mEventListener(NULL),
+   mCoalesceEvents(false),
    mNotified(false)
 {
 }
@@ -62,6 +79,15 @@ Query::Query(const Query& cpy)
  : mPosition(cpy.mPosition),
    mMinSolidAngle(cpy.mMinSolidAngle),
    mMaxRadius(cpy.mMaxRadius),
+   mExitSolidAngle(cpy.mExitSolidAngle),
+   mExitRadius(cpy.mExitRadius),
+   mMaxStaleness(cpy.mMaxStaleness),
+   mMaxResults(cpy.mMaxResults),
+   mRanking(cpy.mRanking),
+   mFrustum(cpy.mFrustum),
+   mChangeListeners(),
+   mEventListener(NULL),
+   mCoalesceEvents(cpy.mCoalesceEvents),
    mNotified(false)
 {
 }
@@ -87,6 +113,49 @@ const float Query::radius() const {
     return mMaxRadius;
 }
 
+const SolidAngle& Query::exitAngle() const {
+    return mExitSolidAngle;
+}
+
+const float Query::exitRadius() const {
+    return mExitRadius;
+}
+
+void Query::hysteresis(const SolidAngle& exit_angle, float exit_radius) {
+    // Handlers don't listen for threshold changes, see header
+    assert( mChangeListeners.empty() );
+    assert( !(mMinSolidAngle < exit_angle) );
+    assert( exit_radius >= mMaxRadius );
+    mExitSolidAngle = exit_angle;
+    mExitRadius = exit_radius;
+}
+
+const Duration& Query::maxStaleness() const {
+    return mMaxStaleness;
+}
+
+void Query::maxStaleness(const Duration& max_staleness) {
+    mMaxStaleness = max_staleness;
+}
+
+uint32 Query::maxResults() const {
+    return mMaxResults;
+}
+
+void Query::maxResults(uint32 max_results) {
+    assert( mChangeListeners.empty() );
+    mMaxResults = max_results;
+}
+
+Query::Ranking Query::ranking() const {
+    return mRanking;
+}
+
+void Query::ranking(Ranking r) {
+    assert( mChangeListeners.empty() );
+    mRanking = r;
+}
+
 void Query::position(const MotionVector3f& new_pos) {
     MotionVector3f old_pos = mPosition;
     mPosition = new_pos;
@@ -94,6 +163,17 @@ void Query::position(const MotionVector3f& new_pos) {
         (*it)->queryPositionUpdated(this, old_pos, new_pos);
 }
 
+const Frustum& Query::frustum() const {
+    return mFrustum;
+}
+
+void Query::frustum(const Frustum& new_frustum) {
+    Frustum old_frustum = mFrustum;
+    mFrustum = new_frustum;
+    for(ChangeListenerList::iterator it = mChangeListeners.begin(); it != mChangeListeners.end(); it++)
+        (*it)->queryFrustumUpdated(this, old_frustum, new_frustum);
+}
+
 void Query::addChangeListener(QueryChangeListener* listener) {
     mChangeListeners.push_back(listener);
 }
@@ -112,11 +192,50 @@ void Query::removeEventListener() {
     mEventListener = NULL;
 }
 
+bool Query::coalesceEvents() const {
+    return mCoalesceEvents;
+}
+
+void Query::coalesceEvents(bool coalesce) {
+    boost::mutex::scoped_lock lock(mEventQueueMutex);
+
+    if (coalesce == mCoalesceEvents) return;
+    mCoalesceEvents = coalesce;
+
+    if (mCoalesceEvents) {
+        // Fold anything already queued into the net event set
+        for(EventQueue::iterator it = mEventQueue.begin(); it != mEventQueue.end(); it++)
+            coalesceEvent(*it);
+        mEventQueue.clear();
+    }
+    else {
+        for(CoalescedEventMap::iterator it = mCoalescedEvents.begin(); it != mCoalescedEvents.end(); it++)
+            mEventQueue.push_back( QueryEvent(it->second, it->first) );
+        mCoalescedEvents.clear();
+    }
+}
+
+void Query::coalesceEvent(const QueryEvent& evt) {
+    CoalescedEventMap::iterator it = mCoalescedEvents.find(evt.id());
+    if (it == mCoalescedEvents.end()) {
+        mCoalescedEvents.insert( CoalescedEventMap::value_type(evt.id(), evt.type()) );
+        return;
+    }
+
+    // An Added followed by a Removed (or vice versa) leaves the consumer's
+    // view of the object unchanged, so the pair cancels out.
+    if (it->second != evt.type())
+        mCoalescedEvents.erase(it);
+}
+
 void Query::pushEvent(const QueryEvent& evt) {
     {
         boost::mutex::scoped_lock lock(mEventQueueMutex);
 
-        mEventQueue.push_back(evt);
+        if (mCoalesceEvents)
+            coalesceEvent(evt);
+        else
+            mEventQueue.push_back(evt);
 
         if (mNotified) return;
         mNotified = true;
@@ -131,7 +250,10 @@ void Query::pushEvents(std::deque<QueryEvent>& evts) {
         boost::mutex::scoped_lock lock(mEventQueueMutex);
 
         while( !evts.empty() ) {
-            mEventQueue.push_back( evts.front() );
+            if (mCoalesceEvents)
+                coalesceEvent( evts.front() );
+            else
+                mEventQueue.push_back( evts.front() );
             evts.pop_front();
         }
 
@@ -149,6 +271,9 @@ void Query::popEvents(std::deque<QueryEvent>& evts) {
 
     assert( evts.empty() );
     mEventQueue.swap(evts);
+    for(CoalescedEventMap::iterator it = mCoalescedEvents.begin(); it != mCoalescedEvents.end(); it++)
+        evts.push_back( QueryEvent(it->second, it->first) );
+    mCoalescedEvents.clear();
     mNotified = false;
 }
 
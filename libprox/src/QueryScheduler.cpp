@@ -0,0 +1,118 @@
+/*  libprox
+ *  QueryScheduler.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <prox/QueryScheduler.hpp>
+#include <float.h>
+#include <algorithm>
+#include <cassert>
+
+namespace Prox {
+
+// Increase in priority per unit/second of query speed
+static const float QueryScheduler_speed_weight = 0.1f;
+// Increase in priority per result change/second
+static const float QueryScheduler_churn_weight = 0.1f;
+
+QueryScheduler::QueryScheduler()
+ : mLastTick(0)
+{
+}
+
+QueryScheduler::~QueryScheduler() {
+}
+
+void QueryScheduler::addQuery(Query* query, const Time& t) {
+    mQueries.insert( QueryInfoMap::value_type(query, QueryInfo(t)) );
+}
+
+void QueryScheduler::removeQuery(const Query* query) {
+    mQueries.erase(const_cast<Query*>(query));
+}
+
+void QueryScheduler::evaluated(Query* query, const Time& t, uint32 nevents) {
+    QueryInfoMap::iterator it = mQueries.find(query);
+    assert( it != mQueries.end() );
+
+    float dt = (t - it->second.lastEvaluated).seconds();
+    if (dt > 0.f)
+        it->second.churn = 0.5f * it->second.churn + 0.5f * (nevents / dt);
+    it->second.lastEvaluated = t;
+}
+
+void QueryScheduler::schedule(const Time& t, std::vector<Query*>* due, uint32* nrequired) {
+    // Expect the next tick to be as far away as the last one was
+    Duration interval = t - mLastTick;
+    mLastTick = t;
+
+    std::vector< std::pair<float, Query*> > required, optional;
+    for(QueryInfoMap::iterator it = mQueries.begin(); it != mQueries.end(); it++) {
+        Query* query = it->first;
+        const QueryInfo& info = it->second;
+
+        Duration staleness = t - info.lastEvaluated;
+        // Queries without a maximum staleness should be refreshed every tick
+        Duration max_staleness = query->maxStaleness();
+        if (max_staleness < interval)
+            max_staleness = interval;
+
+        float activity = 1.f +
+            QueryScheduler_speed_weight * query->position().velocity().length() +
+            QueryScheduler_churn_weight * info.churn;
+        float priority = (max_staleness.seconds() > 0.f) ?
+            (staleness.seconds() * activity / max_staleness.seconds()) :
+            FLT_MAX;
+
+        bool must_refresh = !(query->maxStaleness() == Duration(0)) && !(staleness + interval < query->maxStaleness());
+        if (must_refresh)
+            required.push_back( std::make_pair(-priority, query) );
+        else if (priority >= 1.f)
+            optional.push_back( std::make_pair(-priority, query) );
+    }
+
+    std::sort(required.begin(), required.end());
+    std::sort(optional.begin(), optional.end());
+
+    due->clear();
+    for(uint32 i = 0; i < required.size(); i++)
+        due->push_back(required[i].second);
+    for(uint32 i = 0; i < optional.size(); i++)
+        due->push_back(optional[i].second);
+    *nrequired = required.size();
+}
+
+Duration QueryScheduler::staleness(const Query* query, const Time& t) const {
+    QueryInfoMap::const_iterator it = mQueries.find(const_cast<Query*>(query));
+    assert( it != mQueries.end() );
+    return t - it->second.lastEvaluated;
+}
+
+} // namespace Prox
@@ -31,12 +31,24 @@
  */
 
 #include <prox/RTreeQueryHandler.hpp>
+#include <prox/QueryConstraints.hpp>
+#include <prox/RTreeSnapshot.hpp>
 #include <prox/BoundingSphere.hpp>
+#include <prox/Timer.hpp>
 #include <cassert>
+#include <cmath>
 #include <float.h>
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
 
 namespace Prox {
 
+// Upper bound on validity intervals so they remain reasonably precise
+static const float RTree_max_validity_interval = 60.f;
+// Ticks between checks of the tree's quality when automatic rebuilds are on
+static const uint32 RTree_quality_check_ticks = 64;
+
 struct RTreeNode {
 private:
     static const uint8 LeafFlag = 0x02; // elements are object pointers instead of node pointers
@@ -48,6 +60,7 @@ private:
     } elements;
     RTreeNode* mParent;
     BoundingSphere3f bounding_sphere;
+    float max_speed; // bounds the speed of objects below, unknown (FLT_MAX) after insertions until recomputed
     uint8 flags;
     uint8 count;
     uint8 max_elements;
@@ -83,7 +96,7 @@ public:
 
 
     RTreeNode(uint8 _max_elements)
-     : mParent(NULL), bounding_sphere(), flags(0), count(0), max_elements(_max_elements)
+     : mParent(NULL), bounding_sphere(), max_speed(0.f), flags(0), count(0), max_elements(_max_elements)
     {
         elements.magic = new void*[max_elements];
         for(int i = 0; i < max_elements; i++)
@@ -142,6 +155,10 @@ public:
         bounding_sphere = new_bounds;
     }
 
+    float maxSpeed() const {
+        return max_speed;
+    }
+
     BoundingSphere3f childBounds(int i, const Time& t) {
         if (leaf())
             return object(i)->worldBounds(t);
@@ -153,6 +170,18 @@ public:
         bounding_sphere = BoundingSphere3f();
         for(int i = 0; i < size(); i++)
             bounding_sphere.mergeIn( childBounds(i, t) );
+
+        if (leaf()) {
+            float max_speed_sq = 0.f;
+            for(int i = 0; i < size(); i++)
+                max_speed_sq = std::max(max_speed_sq, object(i)->position().velocity().lengthSquared());
+            max_speed = sqrtf(max_speed_sq);
+        }
+        else {
+            max_speed = 0.f;
+            for(int i = 0; i < size(); i++)
+                max_speed = std::max(max_speed, node(i)->maxSpeed());
+        }
     }
 
     void clear() {
@@ -160,26 +189,50 @@ public:
         for(int i = 0; i < max_elements; i++)
             elements.magic[i] = NULL;
         bounding_sphere = BoundingSphere3f();
+        max_speed = 0.f;
     }
 
     void insert(Object* obj, const Time& t) {
+        insert(obj, obj->worldBounds(t));
+    }
+
+    // Inserts the object with bounds computed ahead of time
+    void insert(Object* obj, const BoundingSphere3f& obj_bounds) {
         assert (count < max_elements);
         assert (leaf() == true);
         elements.objects[count] = obj;
         count++;
-        bounding_sphere = bounding_sphere.merge(obj->worldBounds(t));
+        bounding_sphere = bounding_sphere.merge(obj_bounds);
+        // The object may not be safe to read here, e.g. during background
+        // rebuilds, so its speed is left to the next refit
+        max_speed = FLT_MAX;
     }
 
     void insert(RTreeNode* node) {
         assert (count < max_elements);
         assert (leaf() == false);
         node->parent(this);
+        max_speed = std::max(max_speed, node->maxSpeed());
         elements.nodes[count] = node;
         count++;
         bounding_sphere = bounding_sphere.merge(node->bounds());
     }
+
+    // Removes a child, object or node, without updating the bounds
+    void erase(void* child) {
+        for(int i = 0; i < count; i++) {
+            if (elements.magic[i] != child) continue;
+            elements.magic[i] = elements.magic[count-1];
+            elements.magic[count-1] = NULL;
+            count--;
+            return;
+        }
+        assert(false);
+    }
 };
 
+typedef std::map<Object*, RTreeNode*> RTreeObjectLeafMap;
+
 
 RTreeNode* RTree_choose_leaf(RTreeNode* root, Object* obj, const Time& t) {
     BoundingSphere3f obj_bounds = obj->worldBounds(t);
@@ -349,7 +402,7 @@ RTreeNode* RTree_adjust_tree(RTreeNode* L, RTreeNode* LL, const Time& t) {
 }
 
 // Inserts a new object into the tree, updating any nodes as necessary. Returns the new root node.
-RTreeNode* RTree_insert_object(RTreeNode* root, Object* obj, const Time& t) {
+RTreeNode* RTree_insert_object(RTreeNode* root, Object* obj, const Time& t, RTreeObjectLeafMap* leaves) {
     RTreeNode* leaf_node = RTree_choose_leaf(root, obj, t);
 
     RTreeNode* split_node = NULL;
@@ -358,11 +411,193 @@ RTreeNode* RTree_insert_object(RTreeNode* root, Object* obj, const Time& t) {
     else
         leaf_node->insert(obj, t);
 
+    // a split may have moved any of the leaf's objects, so update all of them
+    for(int i = 0; i < leaf_node->size(); i++)
+        (*leaves)[leaf_node->object(i)] = leaf_node;
+    if (split_node != NULL) {
+        for(int i = 0; i < split_node->size(); i++)
+            (*leaves)[split_node->object(i)] = split_node;
+    }
+
     RTreeNode* new_root = RTree_adjust_tree(leaf_node, split_node, t);
 
     return new_root;
 }
 
+// Fixes up the tree after children have been erased from the given nodes,
+// which must all be at the same depth.  Empty nodes are removed and the bounds
+// of every ancestor are recomputed exactly once.  Returns the new root node.
+RTreeNode* RTree_condense_tree(RTreeNode* root, const std::vector<RTreeNode*>& dirty, const Time& t) {
+    std::set<RTreeNode*> level(dirty.begin(), dirty.end());
+
+    while(!level.empty()) {
+        std::set<RTreeNode*> next_level;
+        for(std::set<RTreeNode*>::iterator it = level.begin(); it != level.end(); it++) {
+            RTreeNode* node = *it;
+            RTreeNode* parent = node->parent();
+
+            if (parent != NULL && node->empty()) {
+                parent->erase(node);
+                delete node;
+            }
+            else {
+                node->recomputeBounds(t);
+            }
+
+            if (parent != NULL)
+                next_level.insert(parent);
+        }
+        level.swap(next_level);
+    }
+
+    // shorten the tree if the root is left with a single child
+    while(!root->leaf() && root->size() == 1) {
+        RTreeNode* child = root->node(0);
+        delete root;
+        root = child;
+        root->parent(NULL);
+    }
+    if (root->empty())
+        root->leaf(true);
+
+    return root;
+}
+
+// Recomputes the bounds of every node in the tree for the given time
+void RTree_update_bounds(RTreeNode* node, const Time& t) {
+    if (!node->leaf()) {
+        for(int i = 0; i < node->size(); i++)
+            RTree_update_bounds(node->node(i), t);
+    }
+    node->recomputeBounds(t);
+}
+
+// Deletes a node and all the nodes below it, but not the objects
+void RTree_delete_tree(RTreeNode* node) {
+    if (!node->leaf()) {
+        for(int i = 0; i < node->size(); i++)
+            RTree_delete_tree(node->node(i));
+    }
+    delete node;
+}
+
+// Interleaves the low 10 bits of each quantized coordinate
+static uint32 RTree_morton_code(uint32 x, uint32 y, uint32 z) {
+    uint32 code = 0;
+    for(int i = 0; i < 10; i++) {
+        code |= ((x >> i) & 1) << (3*i);
+        code |= ((y >> i) & 1) << (3*i+1);
+        code |= ((z >> i) & 1) << (3*i+2);
+    }
+    return code;
+}
+
+// Sorts objects along a Z-order curve so consecutive insertions touch the same
+// parts of the tree.  bounds holds each object's bounds and is sorted with them.
+static void RTree_sort_spatially(std::vector<Object*>& objs, std::vector<BoundingSphere3f>& bounds) {
+    if (objs.size() < 2) return;
+
+    BoundingBox3f region;
+    for(uint32 i = 0; i < objs.size(); i++) {
+        Vector3f center = bounds[i].center();
+        region.mergeIn( BoundingBox3f(center, center) );
+    }
+
+    Vector3f extents = region.extents();
+    float scale = std::max( extents.x, std::max(extents.y, extents.z) );
+    if (scale <= 0.f) return;
+    scale = 1023.f / scale;
+
+    std::vector< std::pair<uint32, uint32> > keyed;
+    for(uint32 i = 0; i < objs.size(); i++) {
+        Vector3f rel = (bounds[i].center() - region.min()) * scale;
+        keyed.push_back( std::make_pair( RTree_morton_code((uint32)rel.x, (uint32)rel.y, (uint32)rel.z), i ) );
+    }
+    std::sort(keyed.begin(), keyed.end());
+
+    std::vector<Object*> sorted_objs(objs.size());
+    std::vector<BoundingSphere3f> sorted_bounds(bounds.size());
+    for(uint32 i = 0; i < keyed.size(); i++) {
+        sorted_objs[i] = objs[keyed[i].second];
+        sorted_bounds[i] = bounds[keyed[i].second];
+    }
+    objs.swap(sorted_objs);
+    bounds.swap(sorted_bounds);
+}
+
+static void RTree_sort_spatially(std::vector<Object*>& objs, const Time& t) {
+    std::vector<BoundingSphere3f> bounds;
+    for(uint32 i = 0; i < objs.size(); i++)
+        bounds.push_back( objs[i]->worldBounds(t) );
+    RTree_sort_spatially(objs, bounds);
+}
+
+// Builds a tree bottom up from the objects, packing runs of them along a
+// Z-order curve into full nodes.  Only the given bounds are used, never the
+// objects themselves, so this is safe to run while they are being updated.
+// Returns the new root node.
+RTreeNode* RTree_bulk_load(std::vector<Object*>& objs, std::vector<BoundingSphere3f>& bounds, uint8 capacity, RTreeObjectLeafMap* leaves) {
+    RTree_sort_spatially(objs, bounds);
+
+    std::vector<RTreeNode*> level;
+    for(uint32 i = 0; i < objs.size(); i++) {
+        if (i % capacity == 0)
+            level.push_back( new RTreeNode(capacity) );
+        level.back()->insert(objs[i], bounds[i]);
+        (*leaves)[objs[i]] = level.back();
+    }
+    if (level.empty())
+        return new RTreeNode(capacity);
+
+    while(level.size() > 1) {
+        std::vector<RTreeNode*> next_level;
+        for(uint32 i = 0; i < level.size(); i++) {
+            if (i % capacity == 0) {
+                next_level.push_back( new RTreeNode(capacity) );
+                next_level.back()->leaf(false);
+            }
+            next_level.back()->insert(level[i]);
+        }
+        level.swap(next_level);
+    }
+    return level[0];
+}
+
+// Volume of the intersection of two spheres
+static float RTree_overlap_volume(const BoundingSphere3f& a, const BoundingSphere3f& b) {
+    float d = (a.center() - b.center()).length();
+    float r1 = a.radius(), r2 = b.radius();
+    if (d >= r1 + r2)
+        return 0.f;
+    if (d <= fabs(r1 - r2))
+        return std::min(a.volume(), b.volume());
+    // the lens formed by two spherical caps
+    return SolidAngle::Pi * (r1 + r2 - d) * (r1 + r2 - d) *
+        (d*d + 2.f*d*r2 - 3.f*r2*r2 + 2.f*d*r1 + 6.f*r1*r2 - 3.f*r1*r1) / (12.f * d);
+}
+
+// Accumulates metrics for the subtree rooted at node, which is at the given depth
+static void RTree_collect_metrics(RTreeNode* node, uint32 depth, const Time& t, RTreeQueryHandler::Metrics* metrics, float* fill) {
+    metrics->depth = std::max(metrics->depth, depth);
+    metrics->nodes++;
+    metrics->nodeVolume += node->bounds().volume();
+    *fill += node->size() / (float)node->capacity();
+
+    if (node->leaf()) {
+        for(int i = 0; i < node->size(); i++) {
+            metrics->objects++;
+            metrics->objectVolume += node->object(i)->worldBounds(t).volume();
+        }
+        return;
+    }
+
+    for(int i = 0; i < node->size(); i++) {
+        for(int j = i + 1; j < node->size(); j++)
+            metrics->siblingOverlap += RTree_overlap_volume(node->node(i)->bounds(), node->node(j)->bounds());
+        RTree_collect_metrics(node->node(i), depth + 1, t, metrics, fill);
+    }
+}
+
 void RTree_verify_bounds(RTreeNode* root, const Time& t) {
     for(int i = 0; i < root->size(); i++)
 //        if (root->bounds().merge(root->leaf() ? root->object(i)->bounds() : root->node(i)->bounds()) != root->bounds())
@@ -378,117 +613,455 @@ void RTree_verify_bounds(RTreeNode* root, const Time& t) {
     }
 }
 
+// Shortens interval to the time it takes to close a gap of margin at speed
+// Intervals shorter than min_interval are reported as 0, since the query
+// will be reevaluated before they end anyway
+static void RTree_limit_interval(float margin, float speed, float min_interval, float* interval) {
+    if (margin <= 0.f) {
+        *interval = 0.f;
+        return;
+    }
+    if (margin < *interval * speed)
+        *interval = margin / speed;
+    if (*interval < min_interval)
+        *interval = 0.f;
+}
+
 RTreeQueryHandler::RTreeQueryHandler(uint8 elements_per_node)
  : QueryHandler(),
    ObjectChangeListener(),
    QueryChangeListener(),
-   mLastTime(0)
+   mLastTime(0),
+   mTickCount(1),
+   mValidityIntervals(true),
+   mMovingObjects(0),
+   mVisitCount(0),
+   mPrunedCount(0),
+   mNodeVisitCount(0),
+   mEvaluatedCount(0),
+   mElementsPerNode(elements_per_node),
+   mRebuildThreshold(0.f),
+   mBaseVolumeRatio(0.f),
+   mRebuildCount(0),
+   mBackgroundRebuild(false),
+   mRebuildThread(NULL),
+   mRebuildDone(false),
+   mRebuildRoot(NULL)
 {
     mRTreeRoot = new RTreeNode(elements_per_node);
 }
 
 RTreeQueryHandler::~RTreeQueryHandler() {
+    if (mRebuildThread != NULL) {
+        mRebuildThread->join();
+        delete mRebuildThread;
+        RTree_delete_tree(mRebuildRoot);
+    }
+
     mObjects.clear();
     for(QueryMap::iterator it = mQueries.begin(); it != mQueries.end(); it++) {
         QueryState* state = it->second;
         delete state;
     }
     mQueries.clear();
+    RTree_delete_tree(mRTreeRoot);
 }
 
 void RTreeQueryHandler::registerObject(Object* obj) {
     insert(obj, mLastTime);
-    mObjects.insert(obj);
+    mChangedObjects.insert(obj);
+    if (obj->position().velocity().lengthSquared() != 0.f)
+        mMovingObjects++;
+    if (mRebuildThread != NULL)
+        mRebuildChanged.insert(obj);
     obj->addChangeListener(this);
 }
 
 void RTreeQueryHandler::registerQuery(Query* query) {
     QueryState* state = new QueryState;
     mQueries[query] = state;
+    mScheduler.addQuery(query, mLastTime);
     query->addChangeListener(this);
 }
 
-bool RTreeQueryHandler::satisfiesConstraints(const Vector3f& qpos, const float qradius, const SolidAngle& qangle, const BoundingSphere3f& obounds) {
-    Vector3f obj_pos = obounds.center();
-    Vector3f to_obj = obj_pos - qpos;
+bool RTreeQueryHandler::validityIntervals() const {
+    return mValidityIntervals;
+}
 
-    // Must satisfy radius constraint
-    if (qradius != Query::InfiniteRadius && (to_obj).lengthSquared() < (qradius+obounds.radius())*(qradius+obounds.radius()))
-        return false;
+void RTreeQueryHandler::validityIntervals(bool enabled) {
+    mValidityIntervals = enabled;
+}
 
-    // Must satisfy solid angle constraint
-    SolidAngle solid_angle = SolidAngle::fromCenterRadius(to_obj, obounds.radius());
+void RTreeQueryHandler::tick(const Time& t) {
+    if (mRebuildThread != NULL)
+        finishRebuild(t);
+    // objects have moved along their motion vectors since the last tick
+    RTree_update_bounds(mRTreeRoot, t);
+    //RTree_verify_bounds(mRTreeRoot, t);
+    checkQuality(t);
+    mVisitCount = 0;
+    mPrunedCount = 0;
+    mNodeVisitCount = 0;
+    mEvaluatedCount = 0;
+
+    mTickCount++;
+    markDirtyRegions(t);
+
+    std::vector<Query*> due;
+    uint32 nrequired;
+    mScheduler.schedule(t, &due, &nrequired);
+    for(uint32 i = 0; i < due.size(); i++) {
+        QueryState* state = mQueries[due[i]];
+        if (unaffected(due[i], state, t)) {
+            state->exactTick = mTickCount;
+            mScheduler.evaluated(due[i], t, 0);
+            continue;
+        }
+        evaluateQuery(due[i], state, t);
+    }
 
-    if (solid_angle < qangle)
+    mChangedRegions.clear();
+    mChangedObjects.clear();
+
+    mLastTime = t;
+}
+
+void RTreeQueryHandler::tick(const Time& t, const Duration& budget) {
+    Timer timer;
+    timer.start();
+
+    // Every query needs the refit bounds, so it can't be deferred and is
+    // charged against the budget before any evaluation
+    if (mRebuildThread != NULL)
+        finishRebuild(t);
+    RTree_update_bounds(mRTreeRoot, t);
+    checkQuality(t);
+    mVisitCount = 0;
+    mPrunedCount = 0;
+    mNodeVisitCount = 0;
+    mEvaluatedCount = 0;
+
+    // Queries about to exceed their maximum staleness are always refreshed,
+    // the rest in priority order while the budget lasts
+    mTickCount++;
+    markDirtyRegions(t);
+
+    std::vector<Query*> due;
+    uint32 nrequired;
+    mScheduler.schedule(t, &due, &nrequired);
+    for(uint32 i = 0; i < due.size(); i++) {
+        if (i >= nrequired && i > 0 && !(timer.elapsed() < budget))
+            break;
+        QueryState* state = mQueries[due[i]];
+        if (unaffected(due[i], state, t)) {
+            state->exactTick = mTickCount;
+            mScheduler.evaluated(due[i], t, 0);
+            continue;
+        }
+        evaluateQuery(due[i], state, t);
+    }
+
+    mChangedRegions.clear();
+    mChangedObjects.clear();
+
+    mLastTime = t;
+}
+
+Duration RTreeQueryHandler::staleness(const Query* query, const Time& t) const {
+    return mScheduler.staleness(query, t);
+}
+
+void RTreeQueryHandler::markDirtyRegions(const Time& t) {
+    // Changed objects keep moving, so validity intervals must account for
+    // where they can get to
+    for(std::set<Object*>::iterator it = mChangedObjects.begin(); it != mChangedObjects.end(); it++) {
+        Object* obj = *it;
+        mChangedRegions.mark( obj->worldBounds(mLastTime), obj->worldBounds(t), obj->position().velocity().length() );
+    }
+}
+
+bool RTreeQueryHandler::unaffected(Query* query, QueryState* state, const Time& t) const {
+    // the cached result must have been exact as of the last tick
+    if (state->exactTick + 1 != mTickCount)
         return false;
 
-    return true;
+    const MotionVector3f& qmotion = query->position();
+    float qradius = query->exitRadius();
+    float qangle_ratio = query->exitAngle().maxDistanceRatioSquared();
+
+    // If nothing is moving, a stationary query only needs to worry about
+    // nearby changes
+    if (mMovingObjects == 0 && qmotion.velocity().lengthSquared() == 0.f &&
+        !mChangedRegions.affects(qmotion.position(), qradius, qangle_ratio))
+        return true;
+
+    // Within the validity interval motion can't change the result, only
+    // objects whose motion changed, and where they could reach before it ends
+    if (mValidityIntervals && t < state->safeUntil) {
+        float remaining = (state->safeUntil - t).seconds();
+        return !mChangedRegions.affects(qmotion.position(t), qradius, qangle_ratio, qmotion.velocity().length(), remaining);
+    }
+
+    return false;
 }
 
-void RTreeQueryHandler::tick(const Time& t) {
-    //RTree_verify_bounds(mRTreeRoot, mLastTime);
-    int count = 0;
-    int ncount = 0;
-    for(QueryMap::iterator query_it = mQueries.begin(); query_it != mQueries.end(); query_it++) {
-        Query* query = query_it->first;
-        QueryState* state = query_it->second;
-        QueryCache newcache;
-
-        Vector3f qpos = query->position(t);
-        float qradius = query->radius();
-        const SolidAngle& qangle = query->angle();
-
-        std::stack<RTreeNode*> node_stack;
-        node_stack.push(mRTreeRoot);
-        while(!node_stack.empty()) {
-            RTreeNode* node = node_stack.top();
-            node_stack.pop();
-
-            if (node->leaf()) {
-                for(int i = 0; i < node->size(); i++) {
-                    count++;
-                    Object* obj = node->object(i);
-                    if (satisfiesConstraints(qpos, qradius, qangle, obj->worldBounds(t)))
-                        newcache.add(obj->id());
+float RTreeQueryHandler::collectAll(Query* query, QueryState* state, const Time& t, QueryCache* newcache) {
+    Vector3f qpos = query->position(t);
+    float qradius = query->radius();
+    float qangle_ratio = query->angle().maxDistanceRatioSquared();
+    // Nodes are pruned with the exit thresholds, which are the more permissive
+    // ones, since they may contain objects which are already in the result.
+    float qexit_radius = query->exitRadius();
+    float qexit_angle_ratio = query->exitAngle().maxDistanceRatioSquared();
+    const Frustum& qfrustum = query->frustum();
+
+    // Validity interval state.  An object can enter once it is within
+    // min(sqrt(ratio)*r, R) of the query and leave once it is beyond it.
+    const Vector3f& qvel = query->position().velocity();
+    float enter_radius = (qradius == Query::InfiniteRadius) ? FLT_MAX : qradius;
+    float exit_radius = (qexit_radius == Query::InfiniteRadius) ? FLT_MAX : qexit_radius;
+    float interval = RTree_max_validity_interval;
+    // Once the interval is shorter than a tick it is no use, so it stops
+    // being tracked
+    float min_interval = (t - mLastTime).seconds();
+
+    std::stack<RTreeNode*> node_stack;
+    node_stack.push(mRTreeRoot);
+    while(!node_stack.empty()) {
+        RTreeNode* node = node_stack.top();
+        node_stack.pop();
+        mNodeVisitCount++;
+
+        if (node->leaf()) {
+            for(int i = 0; i < node->size(); i++) {
+                mVisitCount++;
+                Object* obj = node->object(i);
+                bool member = state->cache.contains(obj->id());
+                BoundingSphere3f obounds = obj->worldBounds(t);
+                if (QueryConstraints_satisfied(qpos, member ? qexit_radius : qradius, member ? qexit_angle_ratio : qangle_ratio, obounds) &&
+                    qfrustum.intersects(qpos, obounds)) {
+                    newcache->add(obj->id());
+                    member = true;
                 }
-            }
-            else {
-                for(int i = 0; i < node->size(); i++) {
-                    count++;
-                    RTreeNode* child = node->node(i);
-                    if (satisfiesConstraints(qpos, qradius, qangle, child->bounds()))
-                        node_stack.push(child);
+                else {
+                    member = false;
+                }
+
+                if (mValidityIntervals && interval > 0.f) {
+                    float speed = (obj->position().velocity() - qvel).length();
+                    if (speed == 0.f)
+                        continue;
+                    float dist = (obounds.center() - qpos).length();
+                    if (member)
+                        RTree_limit_interval(std::min(SolidAngle::maxDistance(qexit_angle_ratio, obounds.radius()), exit_radius) - dist, speed, min_interval, &interval);
                     else
-                        ncount++;
+                        RTree_limit_interval(dist - std::min(SolidAngle::maxDistance(qangle_ratio, obounds.radius()), enter_radius), speed, min_interval, &interval);
                 }
             }
         }
+        else {
+            for(int i = 0; i < node->size(); i++) {
+                mVisitCount++;
+                RTreeNode* child = node->node(i);
+                if (QueryConstraints_node_satisfied(qpos, qexit_radius, qexit_angle_ratio, child->bounds()) &&
+                    qfrustum.intersects(qpos, child->bounds())) {
+                    node_stack.push(child);
+                    continue;
+                }
+                mPrunedCount++;
+
+                if (mValidityIntervals && interval > 0.f) {
+                    // Objects in the node are no larger than it and no further
+                    // from its center than its radius, so none can enter
+                    // until the node could come within either threshold
+                    float speed = child->maxSpeed() + qvel.length();
+                    if (speed == 0.f)
+                        continue;
+                    const BoundingSphere3f& nbounds = child->bounds();
+                    float dist = (nbounds.center() - qpos).length();
+                    float angle_margin = dist - std::max(SolidAngle::maxDistance(qangle_ratio, nbounds.radius()), nbounds.radius());
+                    float radius_margin = dist - nbounds.radius() - enter_radius;
+                    RTree_limit_interval(std::max(angle_margin, radius_margin), speed, min_interval, &interval);
+                }
+            }
+        }
+    }
+
+    return interval;
+}
+
+void RTreeQueryHandler::collectRanked(Query* query, QueryState* state, const Time& t, QueryCache* newcache) {
+    Vector3f qpos = query->position(t);
+    float qradius = query->radius();
+    float qangle_ratio = query->angle().maxDistanceRatioSquared();
+    float qexit_radius = query->exitRadius();
+    float qexit_angle_ratio = query->exitAngle().maxDistanceRatioSquared();
+    const Frustum& qfrustum = query->frustum();
+    uint32 max_results = query->maxResults();
+    Query::Ranking ranking = query->ranking();
+
+    // Best-first traversal: nodes are expanded in order of the best key any
+    // object within them could have, and the search stops once the worst of
+    // the current best candidates beats every remaining node.
+    typedef std::pair<float, RTreeNode*> NodeEntry;
+    std::priority_queue<NodeEntry> node_queue;
+    node_queue.push( NodeEntry(QueryConstraints_rank_key(mRTreeRoot->bounds(), qpos, ranking), mRTreeRoot) );
+
+    // Heap of the best candidates so far, worst on top
+    std::vector<RankedObject> best;
+    while(!node_queue.empty()) {
+        NodeEntry entry = node_queue.top();
+        node_queue.pop();
+        if (best.size() == max_results && entry.first < best.front().key) {
+            mPrunedCount += node_queue.size() + 1;
+            break;
+        }
+
+        RTreeNode* node = entry.second;
+        mNodeVisitCount++;
+        if (node->leaf()) {
+            for(int i = 0; i < node->size(); i++) {
+                mVisitCount++;
+                Object* obj = node->object(i);
+                bool member = state->cache.contains(obj->id());
+                BoundingSphere3f obounds = obj->worldBounds(t);
+                if (!QueryConstraints_satisfied(qpos, member ? qexit_radius : qradius, member ? qexit_angle_ratio : qangle_ratio, obounds) ||
+                    !qfrustum.intersects(qpos, obounds))
+                    continue;
+
+                RankedObject candidate(QueryConstraints_rank_key(obounds, qpos, ranking), obj->id());
+                if (best.size() == max_results) {
+                    if (!QueryConstraints_ranks_before(candidate, best.front()))
+                        continue;
+                    std::pop_heap(best.begin(), best.end(), QueryConstraints_ranks_before);
+                    best.pop_back();
+                }
+                best.push_back(candidate);
+                std::push_heap(best.begin(), best.end(), QueryConstraints_ranks_before);
+            }
+        }
+        else {
+            for(int i = 0; i < node->size(); i++) {
+                mVisitCount++;
+                RTreeNode* child = node->node(i);
+                if (QueryConstraints_node_satisfied(qpos, qexit_radius, qexit_angle_ratio, child->bounds()) &&
+                    qfrustum.intersects(qpos, child->bounds()))
+                    node_queue.push( NodeEntry(QueryConstraints_rank_key(child->bounds(), qpos, ranking), child) );
+                else
+                    mPrunedCount++;
+            }
+        }
+    }
 
-        std::deque<QueryEvent> events;
-        state->cache.exchange(newcache, &events);
+    for(uint32 i = 0; i < best.size(); i++)
+        newcache->add(best[i].id);
+}
 
-        query->pushEvents(events);
+void RTreeQueryHandler::evaluateQuery(Query* query, QueryState* state, const Time& t) {
+    QueryCache newcache;
+    mEvaluatedCount++;
+    // Limited results can change as objects are reordered without any of
+    // them crossing a threshold, and objects can cross frustum planes, so
+    // neither gets a validity interval
+    float interval = 0.f;
+    if (query->maxResults() == 0) {
+        interval = collectAll(query, state, t, &newcache);
+        if (!query->frustum().unbounded())
+            interval = 0.f;
     }
-    std::cout << "count: " << count << " " << ncount << std::endl;
-    mLastTime = t;
+    else
+        collectRanked(query, state, t, &newcache);
+
+    std::deque<QueryEvent> events;
+    state->cache.exchange(newcache, &events);
+    mScheduler.evaluated(query, t, events.size());
+    state->exactTick = mTickCount;
+    if (mValidityIntervals)
+        state->safeUntil = t + Duration::seconds(interval);
+
+    query->pushEvents(events);
 }
 
 void RTreeQueryHandler::objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos) {
-    // FIXME update info in RTree
+    ObjectPositionUpdate update(obj, old_pos, new_pos);
+    objectsPositionUpdated(&update, 1);
+}
+
+void RTreeQueryHandler::objectsPositionUpdated(const ObjectPositionUpdate* updates, std::size_t count) {
+    // Objects which are still within their leaf's bounds are handled by the
+    // refit at the next tick, only those which left it need to be reinserted.
+    std::vector<Object*> moved;
+    for(std::size_t i = 0; i < count; i++) {
+        Object* obj = updates[i].object;
+        const BoundingSphere3f& bounds = obj->bounds();
+        mChangedRegions.mark( BoundingSphere3f(updates[i].old_pos.position(mLastTime) + bounds.center(), bounds.radius()) );
+        mChangedObjects.insert(obj);
+        if (updates[i].old_pos.velocity().lengthSquared() != 0.f)
+            mMovingObjects--;
+        if (updates[i].new_pos.velocity().lengthSquared() != 0.f)
+            mMovingObjects++;
+        if (mRebuildThread != NULL)
+            mRebuildChanged.insert(obj);
+
+        ObjectLeafMap::iterator it = mObjects.find(obj);
+        assert( it != mObjects.end() );
+        if (!it->second->bounds().contains( obj->worldBounds(mLastTime) ))
+            moved.push_back(obj);
+    }
+
+    reinsert(moved, mLastTime);
 }
 
 void RTreeQueryHandler::objectBoundingSphereUpdated(Object* obj, const BoundingSphere3f& old_bounds, const BoundingSphere3f& new_bounds) {
-    // FIXME update bounding info in RTree, possibly removing and reinserting
+    mChangedRegions.mark( BoundingSphere3f(obj->position(mLastTime) + old_bounds.center(), old_bounds.radius()) );
+    mChangedObjects.insert(obj);
+    if (mRebuildThread != NULL)
+        mRebuildChanged.insert(obj);
+
+    ObjectLeafMap::iterator it = mObjects.find(obj);
+    assert( it != mObjects.end() );
+    if (it->second->bounds().contains( obj->worldBounds(mLastTime) ))
+        return;
+
+    std::vector<Object*> moved(1, obj);
+    reinsert(moved, mLastTime);
 }
 
 void RTreeQueryHandler::objectDeleted(const Object* obj) {
-    assert( mObjects.find(const_cast<Object*>(obj)) != mObjects.end() );
-    mObjects.erase(const_cast<Object*>(obj));
-    // FIXME remove object from RTree
+    ObjectLeafMap::iterator it = mObjects.find(const_cast<Object*>(obj));
+    assert( it != mObjects.end() );
+
+    mChangedRegions.mark( obj->worldBounds(mLastTime) );
+    mChangedObjects.erase(it->first);
+    if (obj->position().velocity().lengthSquared() != 0.f)
+        mMovingObjects--;
+    if (mRebuildThread != NULL) {
+        mRebuildChanged.erase(it->first);
+        mRebuildDeleted.insert(it->first);
+    }
+
+    RTreeNode* leaf = it->second;
+    leaf->erase(it->first);
+    it->first->removeChangeListener(this);
+    mObjects.erase(it);
+
+    mRTreeRoot = RTree_condense_tree(mRTreeRoot, std::vector<RTreeNode*>(1, leaf), mLastTime);
 }
 
 void RTreeQueryHandler::queryPositionUpdated(Query* query, const MotionVector3f& old_pos, const MotionVector3f& new_pos) {
-    // Nothing to be done, we use values directly from the query
+    // Positions are used directly from the query, but the cached result can
+    // no longer be assumed exact
+    QueryMap::iterator it = mQueries.find(query);
+    assert( it != mQueries.end() );
+    it->second->exactTick = 0;
+    it->second->safeUntil = Time(0);
+}
+
+void RTreeQueryHandler::queryFrustumUpdated(Query* query, const Frustum& old_frustum, const Frustum& new_frustum) {
+    QueryMap::iterator it = mQueries.find(query);
+    assert( it != mQueries.end() );
+    it->second->exactTick = 0;
+    it->second->safeUntil = Time(0);
 }
 
 void RTreeQueryHandler::queryDeleted(const Query* query) {
@@ -497,10 +1070,266 @@ void RTreeQueryHandler::queryDeleted(const Query* query) {
     QueryState* state = it->second;
     delete state;
     mQueries.erase(it);
+    mScheduler.removeQuery(query);
+}
+
+bool RTreeQueryHandler::writeSnapshot(const std::string& path, const Time& t) const {
+    // Breadth first order keeps each node's children contiguous
+    std::vector<RTreeNode*> order(1, mRTreeRoot);
+    std::vector<RTreeSnapshotNode> nodes;
+    std::vector<RTreeSnapshotObject> objects;
+    std::vector<BoundingSphere3f> node_bounds;
+    for(uint32 i = 0; i < order.size(); i++) {
+        RTreeNode* node = order[i];
+        RTreeSnapshotNode flat;
+        flat.leaf = node->leaf() ? 1 : 0;
+        flat.count = node->size();
+        flat.firstChild = node->leaf() ? objects.size() : order.size();
+
+        // Node bounds are recomputed for time t from the objects' bounds
+        BoundingSphere3f bounds;
+        for(int j = 0; j < node->size(); j++) {
+            if (!node->leaf()) {
+                order.push_back(node->node(j));
+                continue;
+            }
+            Object* obj = node->object(j);
+            BoundingSphere3f obounds = obj->worldBounds(t);
+            bounds.mergeIn(obounds);
+
+            RTreeSnapshotObject flat_obj;
+            std::memcpy(flat_obj.id, obj->id().begin(), ObjectID::static_size);
+            flat_obj.center[0] = obounds.center().x; flat_obj.center[1] = obounds.center().y; flat_obj.center[2] = obounds.center().z;
+            flat_obj.radius = obounds.radius();
+            objects.push_back(flat_obj);
+        }
+        nodes.push_back(flat);
+        node_bounds.push_back(bounds);
+    }
+
+    // Children come after their parents, so a reverse pass sees them first
+    for(uint32 i = nodes.size(); i-- > 0; ) {
+        if (!nodes[i].leaf)
+            for(uint32 j = 0; j < nodes[i].count; j++)
+                node_bounds[i].mergeIn( node_bounds[nodes[i].firstChild + j] );
+        const Vector3f& center = node_bounds[i].center();
+        nodes[i].center[0] = center.x; nodes[i].center[1] = center.y; nodes[i].center[2] = center.z;
+        nodes[i].radius = node_bounds[i].radius();
+    }
+
+    RTreeSnapshotHeader header;
+    std::memcpy(header.magic, RTreeSnapshot_magic, sizeof(header.magic));
+    header.byteOrder = RTreeSnapshot_byte_order;
+    header.version = RTreeSnapshot_version;
+    header.nodeCount = nodes.size();
+    header.objectCount = objects.size();
+    header.time = t.microseconds();
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+        return false;
+    bool success = (fwrite(&header, sizeof(header), 1, file) == 1);
+    if (success)
+        success = (fwrite(&nodes[0], sizeof(RTreeSnapshotNode), nodes.size(), file) == nodes.size());
+    if (success && !objects.empty())
+        success = (fwrite(&objects[0], sizeof(RTreeSnapshotObject), objects.size(), file) == objects.size());
+    if (fclose(file) != 0)
+        success = false;
+    return success;
+}
+
+RTreeQueryHandler::Metrics RTreeQueryHandler::metrics() const {
+    return metrics(mLastTime);
+}
+
+RTreeQueryHandler::Metrics RTreeQueryHandler::metrics(const Time& t) const {
+    Metrics result;
+    result.depth = 0;
+    result.nodes = 0;
+    result.objects = 0;
+    result.nodeVolume = 0.f;
+    result.objectVolume = 0.f;
+    result.siblingOverlap = 0.f;
+
+    float fill = 0.f;
+    RTree_collect_metrics(mRTreeRoot, 1, t, &result, &fill);
+    result.fillFactor = fill / result.nodes;
+    result.nodesVisitedPerQuery = (mEvaluatedCount > 0) ? (mNodeVisitCount / (float)mEvaluatedCount) : 0.f;
+    return result;
+}
+
+void RTreeQueryHandler::rebuild() {
+    rebuild(mLastTime);
+}
+
+void RTreeQueryHandler::rebuild(const Time& t) {
+    if (mBackgroundRebuild) {
+        if (mRebuildThread == NULL)
+            startRebuild(t);
+        return;
+    }
+
+    std::vector<Object*> objs;
+    std::vector<BoundingSphere3f> bounds;
+    for(ObjectLeafMap::iterator it = mObjects.begin(); it != mObjects.end(); it++) {
+        objs.push_back(it->first);
+        bounds.push_back(it->first->worldBounds(t));
+    }
+
+    RTree_delete_tree(mRTreeRoot);
+    mRTreeRoot = RTree_bulk_load(objs, bounds, mElementsPerNode, &mObjects);
+    mBaseVolumeRatio = volumeRatio(t);
+    mRebuildCount++;
+}
+
+bool RTreeQueryHandler::backgroundRebuild() const {
+    return mBackgroundRebuild;
+}
+
+void RTreeQueryHandler::backgroundRebuild(bool enabled) {
+    mBackgroundRebuild = enabled;
+}
+
+bool RTreeQueryHandler::rebuilding() const {
+    return (mRebuildThread != NULL);
+}
+
+void RTreeQueryHandler::startRebuild(const Time& t) {
+    assert(mRebuildThread == NULL);
+
+    // The thread only sees this snapshot, never the objects themselves
+    mRebuildObjects.clear();
+    mRebuildBounds.clear();
+    for(ObjectLeafMap::iterator it = mObjects.begin(); it != mObjects.end(); it++) {
+        mRebuildObjects.push_back(it->first);
+        mRebuildBounds.push_back(it->first->worldBounds(t));
+    }
+    mRebuildRoot = NULL;
+    mRebuildLeaves.clear();
+    mRebuildDone = false;
+
+    mRebuildThread = new boost::thread( boost::bind(&RTreeQueryHandler::rebuildMain, this) );
+}
+
+void RTreeQueryHandler::rebuildMain() {
+    RTreeNode* root = RTree_bulk_load(mRebuildObjects, mRebuildBounds, mElementsPerNode, &mRebuildLeaves);
+
+    boost::mutex::scoped_lock lock(mRebuildMutex);
+    mRebuildRoot = root;
+    mRebuildDone = true;
+}
+
+void RTreeQueryHandler::finishRebuild(const Time& t) {
+    {
+        boost::mutex::scoped_lock lock(mRebuildMutex);
+        if (!mRebuildDone)
+            return;
+    }
+    mRebuildThread->join();
+    delete mRebuildThread;
+    mRebuildThread = NULL;
+
+    RTree_delete_tree(mRTreeRoot);
+    mRTreeRoot = mRebuildRoot;
+    mRebuildRoot = NULL;
+    mObjects.swap(mRebuildLeaves);
+    mRebuildLeaves.clear();
+
+    // Replay what happened while the tree was being built: deleted objects
+    // are dropped, those registered since are inserted, and changed ones are
+    // reinserted if they have left their leaf's bounds, as they would have
+    // been in the old tree.  Every leaf of a bulk loaded tree is at the same
+    // depth, as condensing requires.
+    std::vector<RTreeNode*> dirty_leaves;
+    for(std::set<Object*>::iterator it = mRebuildDeleted.begin(); it != mRebuildDeleted.end(); it++) {
+        ObjectLeafMap::iterator leaf_it = mObjects.find(*it);
+        if (leaf_it == mObjects.end())
+            continue;
+        leaf_it->second->erase(*it);
+        dirty_leaves.push_back(leaf_it->second);
+        mObjects.erase(leaf_it);
+    }
+
+    std::vector<Object*> changed;
+    for(std::set<Object*>::iterator it = mRebuildChanged.begin(); it != mRebuildChanged.end(); it++) {
+        ObjectLeafMap::iterator leaf_it = mObjects.find(*it);
+        if (leaf_it != mObjects.end()) {
+            if (leaf_it->second->bounds().contains( (*it)->worldBounds(t) ))
+                continue;
+            leaf_it->second->erase(*it);
+            dirty_leaves.push_back(leaf_it->second);
+            mObjects.erase(leaf_it);
+        }
+        changed.push_back(*it);
+    }
+    if (!dirty_leaves.empty())
+        mRTreeRoot = RTree_condense_tree(mRTreeRoot, dirty_leaves, t);
+
+    RTree_sort_spatially(changed, t);
+    for(uint32 i = 0; i < changed.size(); i++)
+        insert(changed[i], t);
+
+    mRebuildChanged.clear();
+    mRebuildDeleted.clear();
+    mRebuildObjects.clear();
+    mRebuildBounds.clear();
+    // The baseline is remeasured once the new tree's bounds are refit
+    mBaseVolumeRatio = 0.f;
+    mRebuildCount++;
+}
+
+uint32 RTreeQueryHandler::rebuildCount() const {
+    return mRebuildCount;
+}
+
+float RTreeQueryHandler::rebuildThreshold() const {
+    return mRebuildThreshold;
+}
+
+void RTreeQueryHandler::rebuildThreshold(float factor) {
+    mRebuildThreshold = factor;
+    mBaseVolumeRatio = 0.f;
+}
+
+float RTreeQueryHandler::volumeRatio(const Time& t) const {
+    Metrics m = metrics(t);
+    return (m.objectVolume > 0.f) ? (m.nodeVolume / m.objectVolume) : 0.f;
+}
+
+void RTreeQueryHandler::checkQuality(const Time& t) {
+    if (mRebuildThreshold <= 0.f || mRebuildThread != NULL)
+        return;
+
+    // The first check after enabling or a rebuild sets the baseline
+    if (mBaseVolumeRatio <= 0.f) {
+        mBaseVolumeRatio = volumeRatio(t);
+        return;
+    }
+    if (mTickCount % RTree_quality_check_ticks != 0)
+        return;
+
+    if (volumeRatio(t) > mBaseVolumeRatio * mRebuildThreshold)
+        rebuild(t);
 }
 
 void RTreeQueryHandler::insert(Object* obj, const Time& t) {
-    mRTreeRoot = RTree_insert_object(mRTreeRoot, obj, t);
+    mRTreeRoot = RTree_insert_object(mRTreeRoot, obj, t, &mObjects);
+}
+
+void RTreeQueryHandler::reinsert(std::vector<Object*>& objs, const Time& t) {
+    if (objs.empty()) return;
+
+    std::vector<RTreeNode*> dirty_leaves;
+    for(uint32 i = 0; i < objs.size(); i++) {
+        RTreeNode* leaf = mObjects[objs[i]];
+        leaf->erase(objs[i]);
+        dirty_leaves.push_back(leaf);
+    }
+    mRTreeRoot = RTree_condense_tree(mRTreeRoot, dirty_leaves, t);
+
+    RTree_sort_spatially(objs, t);
+    for(uint32 i = 0; i < objs.size(); i++)
+        insert(objs[i], t);
 }
 
 } // namespace Prox
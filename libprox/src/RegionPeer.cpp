@@ -0,0 +1,282 @@
+/*  libprox
+ *  RegionPeer.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <prox/RegionPeer.hpp>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+
+namespace Prox {
+
+// Bytes read from the socket per recv() call
+static const std::size_t RegionPeer_read_size = 65536;
+
+RegionPeer::RegionPeer(QueryHandler* handler, const BoundingBox3f& remote_region, float margin, int fd, RegionPeerListener* listener)
+ : ObjectChangeListener(),
+   ProtocolListener(),
+   mHandler(handler),
+   mRemoteRegion(remote_region),
+   mMargin(margin),
+   mSocket(fd),
+   mListener(listener)
+{
+}
+
+RegionPeer::~RegionPeer() {
+    for(LocalObjectMap::iterator it = mLocalObjects.begin(); it != mLocalObjects.end(); it++)
+        it->first->removeChangeListener(this);
+    mLocalObjects.clear();
+
+    for(MirrorMap::iterator it = mMirrors.begin(); it != mMirrors.end(); it++)
+        delete it->second;
+    mMirrors.clear();
+
+    if (mSocket >= 0)
+        close(mSocket);
+}
+
+static bool RegionPeer_socket_address(const std::string& path, sockaddr_un* addr) {
+    if (path.size() >= sizeof(addr->sun_path))
+        return false;
+    std::memset(addr, 0, sizeof(sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    std::memcpy(addr->sun_path, path.c_str(), path.size());
+    return true;
+}
+
+int RegionPeer::listen(const std::string& path) {
+    sockaddr_un addr;
+    if (!RegionPeer_socket_address(path, &addr))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    unlink(path.c_str());
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(fd, 8) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int RegionPeer::accept(int listen_fd) {
+    int fd;
+    do {
+        fd = ::accept(listen_fd, NULL, NULL);
+    } while(fd < 0 && errno == EINTR);
+    return fd;
+}
+
+int RegionPeer::connect(const std::string& path) {
+    sockaddr_un addr;
+    if (!RegionPeer_socket_address(path, &addr))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void RegionPeer::addObject(Object* obj) {
+    assert( mLocalObjects.find(obj) == mLocalObjects.end() );
+    mLocalObjects[obj] = LocalObject();
+    obj->addChangeListener(this);
+}
+
+void RegionPeer::forwardEvents(uint32 query, const std::deque<QueryEvent>& events) {
+    if (!events.empty())
+        mWriter.queryEvents(query, events);
+}
+
+float RegionPeer::remoteDistanceSquared(const Vector3f& pos) const {
+    float dist_sq = 0.f;
+    for(uint32 axis = 0; axis < 3; axis++) {
+        float d = 0.f;
+        if (pos[axis] < mRemoteRegion.min()[axis])
+            d = mRemoteRegion.min()[axis] - pos[axis];
+        else if (pos[axis] > mRemoteRegion.max()[axis])
+            d = pos[axis] - mRemoteRegion.max()[axis];
+        dist_sq += d * d;
+    }
+    return dist_sq;
+}
+
+bool RegionPeer::remoteContains(const Vector3f& pos) const {
+    // Half open so a point on a shared face belongs to exactly one region
+    for(uint32 axis = 0; axis < 3; axis++)
+        if (pos[axis] < mRemoteRegion.min()[axis] || !(pos[axis] < mRemoteRegion.max()[axis]))
+            return false;
+    return true;
+}
+
+bool RegionPeer::send(const Time& t) {
+    std::vector<Object*> departed;
+    for(LocalObjectMap::iterator it = mLocalObjects.begin(); it != mLocalObjects.end(); ) {
+        LocalObjectMap::iterator cur = it++;
+        Object* obj = cur->first;
+        LocalObject& local = cur->second;
+        Vector3f center = obj->worldBounds(t).center();
+
+        if (remoteContains(center)) {
+            // The peer replaces any mirror it has with the migrated object
+            mWriter.objectMigrated(obj->id(), obj->position(), obj->bounds());
+            obj->removeChangeListener(this);
+            mLocalObjects.erase(cur);
+            departed.push_back(obj);
+        }
+        else if (remoteDistanceSquared(center) <= mMargin * mMargin) {
+            if (!local.mirrored || local.changed)
+                mWriter.objectUpdated(obj->id(), obj->position(), obj->bounds());
+            local.mirrored = true;
+            local.changed = false;
+        }
+        else if (local.mirrored) {
+            mWriter.objectRemoved(obj->id());
+            local.mirrored = false;
+        }
+    }
+
+    bool success = true;
+    if (!mWriter.empty()) {
+        success = writeAll( mWriter.frame() );
+        mWriter.clear();
+    }
+
+    // Notified last since the listener is likely to delete the objects
+    for(uint32 i = 0; i < departed.size(); i++)
+        mListener->objectDeparted(departed[i]);
+
+    return success;
+}
+
+bool RegionPeer::writeAll(const std::vector<uint8>& data) {
+    std::size_t sent = 0;
+    while(sent < data.size()) {
+        ssize_t n = ::send(mSocket, &data[sent], data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+bool RegionPeer::receive() {
+    bool open = true;
+    uint8 buffer[RegionPeer_read_size];
+    while(true) {
+        ssize_t n = recv(mSocket, buffer, RegionPeer_read_size, MSG_DONTWAIT);
+        if (n > 0) {
+            mReader.append(buffer, n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            open = false;
+        break;
+    }
+
+    // Anything received before the connection closed is still applied
+    return mReader.dispatch(this) && open;
+}
+
+void RegionPeer::objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos) {
+    LocalObjectMap::iterator it = mLocalObjects.find(obj);
+    assert( it != mLocalObjects.end() );
+    it->second.changed = true;
+}
+
+void RegionPeer::objectBoundingSphereUpdated(Object* obj, const BoundingSphere3f& old_bounds, const BoundingSphere3f& new_bounds) {
+    LocalObjectMap::iterator it = mLocalObjects.find(obj);
+    assert( it != mLocalObjects.end() );
+    it->second.changed = true;
+}
+
+void RegionPeer::objectDeleted(const Object* obj) {
+    LocalObjectMap::iterator it = mLocalObjects.find(const_cast<Object*>(obj));
+    assert( it != mLocalObjects.end() );
+    if (it->second.mirrored)
+        mWriter.objectRemoved(obj->id());
+    mLocalObjects.erase(it);
+    const_cast<Object*>(obj)->removeChangeListener(this);
+}
+
+void RegionPeer::objectUpdated(const ObjectID& id, const MotionVector3f& pos, const BoundingSphere3f& bounds) {
+    MirrorMap::iterator it = mMirrors.find(id);
+    if (it == mMirrors.end()) {
+        Object* mirror = new Object(id, pos, bounds);
+        mMirrors.insert( MirrorMap::value_type(id, mirror) );
+        mHandler->registerObject(mirror);
+        return;
+    }
+
+    Object* mirror = it->second;
+    mirror->position(pos);
+    if (mirror->bounds().center() != bounds.center() || mirror->bounds().radius() != bounds.radius())
+        mirror->bounds(bounds);
+}
+
+void RegionPeer::objectRemoved(const ObjectID& id) {
+    MirrorMap::iterator it = mMirrors.find(id);
+    if (it == mMirrors.end())
+        return;
+    // Deleting the mirror removes it from the handler
+    delete it->second;
+    mMirrors.erase(it);
+}
+
+void RegionPeer::objectMigrated(const ObjectID& id, const MotionVector3f& pos, const BoundingSphere3f& bounds) {
+    objectRemoved(id);
+
+    Object* obj = new Object(id, pos, bounds);
+    mHandler->registerObject(obj);
+    addObject(obj);
+    mListener->objectArrived(obj);
+}
+
+void RegionPeer::queryEventsReceived(uint32 query, std::deque<QueryEvent>& events) {
+    mListener->queryEventsReceived(query, events);
+}
+
+} // namespace Prox
@@ -0,0 +1,492 @@
+/*  libprox
+ *  ShardedQueryHandler.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <prox/ShardedQueryHandler.hpp>
+#include <prox/QueryConstraints.hpp>
+#include <boost/bind.hpp>
+#include <float.h>
+#include <algorithm>
+
+namespace Prox {
+
+// Longest an object goes without its shard being checked, so distant exit
+// times remain representable
+static const float Sharded_max_migration_interval = 3600.f;
+
+// Returns true if an object with the given bounds satisfies the query's exit
+// thresholds and frustum, matching the inner handlers' tests for members
+static bool Sharded_satisfies_exit(const Query* query, const Vector3f& qpos, const BoundingSphere3f& obounds) {
+    return QueryConstraints_satisfied(qpos, query->exitRadius(), query->exitAngle().maxDistanceRatioSquared(), obounds) &&
+        query->frustum().intersects(qpos, obounds);
+}
+
+ShardedQueryHandler::ShardedQueryHandler(const BoundingBox3f& region, uint32 nx, uint32 ny, uint32 nz, const std::vector<QueryHandler*>& handlers)
+ : QueryHandler(),
+   ObjectChangeListener(),
+   QueryChangeListener(),
+   mRegion(region),
+   mShards(handlers),
+   mWorkGeneration(0),
+   mWorkRemaining(0),
+   mWorkTime(0),
+   mWorkBudget(0),
+   mWorkBudgeted(false),
+   mShutdown(false),
+   mLastTime(0)
+{
+    assert( nx > 0 && ny > 0 && nz > 0 );
+    assert( handlers.size() == nx * ny * nz );
+
+    mDivisions[0] = nx; mDivisions[1] = ny; mDivisions[2] = nz;
+    Vector3f extents = region.extents();
+    mCellSize = Vector3f(extents.x / nx, extents.y / ny, extents.z / nz);
+
+    for(uint32 i = 0; i < mShards.size(); i++)
+        mWorkers.create_thread( boost::bind(&ShardedQueryHandler::workerMain, this, i) );
+}
+
+ShardedQueryHandler::~ShardedQueryHandler() {
+    {
+        boost::mutex::scoped_lock lock(mWorkMutex);
+        mShutdown = true;
+    }
+    mWorkCondition.notify_all();
+    mWorkers.join_all();
+
+    // The copies are deleted while their handlers are still alive so the
+    // handlers stop listening to them
+    for(ObjectMap::iterator it = mObjects.begin(); it != mObjects.end(); it++) {
+        it->first->removeChangeListener(this);
+        delete it->second.copy;
+    }
+    mObjects.clear();
+    mObjectIDs.clear();
+    mMigrations.clear();
+
+    for(QueryMap::iterator it = mQueries.begin(); it != mQueries.end(); it++) {
+        it->first->removeChangeListener(this);
+        QueryState* state = it->second;
+        for(ShardQueryMap::iterator shard_it = state->shards.begin(); shard_it != state->shards.end(); shard_it++)
+            delete shard_it->second.query;
+        delete state;
+    }
+    mQueries.clear();
+
+    for(uint32 i = 0; i < mShards.size(); i++)
+        delete mShards[i];
+    mShards.clear();
+}
+
+uint32 ShardedQueryHandler::cellCoordinate(float v, uint32 axis) const {
+    uint32 n = mDivisions[axis];
+    if (n == 1)
+        return 0;
+    float rel = (v - mRegion.min()[axis]) / mCellSize[axis];
+    if (!(rel > 0.f))
+        return 0;
+    if (rel >= (float)n)
+        return n - 1;
+    return std::min( (uint32)rel, n - 1 );
+}
+
+uint32 ShardedQueryHandler::shardIndex(const Vector3f& pos) const {
+    return cellCoordinate(pos.x, 0) + mDivisions[0] * ( cellCoordinate(pos.y, 1) + mDivisions[1] * cellCoordinate(pos.z, 2) );
+}
+
+void ShardedQueryHandler::registerObject(Object* obj) {
+    ObjectState& state = mObjects[obj];
+    state.migration = mMigrations.end();
+    addToShard(obj, &state, mLastTime);
+    scheduleMigration(obj, &state, mLastTime);
+    mObjectIDs[obj->id()] = obj;
+    obj->addChangeListener(this);
+}
+
+void ShardedQueryHandler::registerQuery(Query* query) {
+    QueryState* state = new QueryState;
+    mQueries[query] = state;
+    query->addChangeListener(this);
+    updateFanOut(query, state, mLastTime);
+}
+
+void ShardedQueryHandler::addToShard(Object* obj, ObjectState* state, const Time& t) {
+    state->shard = shardIndex( obj->worldBounds(t).center() );
+    state->copy = new Object(obj->id(), obj->position(), obj->bounds());
+    mShards[state->shard]->registerObject(state->copy);
+}
+
+void ShardedQueryHandler::scheduleMigration(Object* obj, ObjectState* state, const Time& t) {
+    unscheduleMigration(state);
+
+    Vector3f pos = obj->worldBounds(t).center();
+    const Vector3f& vel = obj->position().velocity();
+
+    // Time until the center crosses one of the shard's inner faces
+    uint32 cell[3];
+    cell[0] = state->shard % mDivisions[0];
+    cell[1] = (state->shard / mDivisions[0]) % mDivisions[1];
+    cell[2] = state->shard / (mDivisions[0] * mDivisions[1]);
+
+    float exit = FLT_MAX;
+    if (shardIndex(pos) != state->shard)
+        exit = 0.f;
+    for(uint32 axis = 0; axis < 3; axis++) {
+        float lo = mRegion.min()[axis] + mCellSize[axis] * cell[axis];
+        if (vel[axis] > 0.f && cell[axis] + 1 < mDivisions[axis])
+            exit = std::min(exit, (lo + mCellSize[axis] - pos[axis]) / vel[axis]);
+        else if (vel[axis] < 0.f && cell[axis] > 0)
+            exit = std::min(exit, (lo - pos[axis]) / vel[axis]);
+    }
+
+    if (exit == FLT_MAX)
+        return;
+    exit = std::max(0.f, std::min(exit, Sharded_max_migration_interval));
+    state->migration = mMigrations.insert( MigrationQueue::value_type(t + Duration::seconds(exit), obj) );
+}
+
+void ShardedQueryHandler::unscheduleMigration(ObjectState* state) {
+    if (state->migration == mMigrations.end())
+        return;
+    mMigrations.erase(state->migration);
+    state->migration = mMigrations.end();
+}
+
+void ShardedQueryHandler::migrateObjects(const Time& t) {
+    std::vector<Object*> due;
+    for(MigrationQueue::iterator it = mMigrations.begin(); it != mMigrations.end() && !(t < it->first); it++)
+        due.push_back(it->second);
+
+    for(uint32 i = 0; i < due.size(); i++) {
+        Object* obj = due[i];
+        ObjectState& state = mObjects[obj];
+        unscheduleMigration(&state);
+
+        if (shardIndex( obj->worldBounds(t).center() ) != state.shard) {
+            // Deleting the copy removes it from the old shard's handler
+            delete state.copy;
+            addToShard(obj, &state, t);
+            mMigrated.insert(obj->id());
+        }
+        scheduleMigration(obj, &state, t);
+    }
+}
+
+void ShardedQueryHandler::updateFanOut(Query* query, QueryState* state, const Time& t) {
+    Vector3f qpos = query->position(t);
+    float qradius = query->exitRadius();
+
+    // Object centers must be within the exit radius, so the query only needs
+    // the shards overlapping the box around that sphere
+    uint32 lo[3], hi[3];
+    for(uint32 axis = 0; axis < 3; axis++) {
+        if (qradius == Query::InfiniteRadius) {
+            lo[axis] = 0;
+            hi[axis] = mDivisions[axis] - 1;
+        }
+        else {
+            lo[axis] = cellCoordinate(qpos[axis] - qradius, axis);
+            hi[axis] = cellCoordinate(qpos[axis] + qradius, axis);
+        }
+    }
+
+    std::set<uint32> reached;
+    for(uint32 z = lo[2]; z <= hi[2]; z++)
+        for(uint32 y = lo[1]; y <= hi[1]; y++)
+            for(uint32 x = lo[0]; x <= hi[0]; x++)
+                reached.insert( x + mDivisions[0] * (y + mDivisions[1] * z) );
+
+    for(ShardQueryMap::iterator it = state->shards.begin(); it != state->shards.end(); ) {
+        ShardQueryMap::iterator cur = it++;
+        if (reached.find(cur->first) == reached.end())
+            removeShardQuery(state, cur);
+    }
+
+    for(std::set<uint32>::iterator it = reached.begin(); it != reached.end(); it++) {
+        if (state->shards.find(*it) != state->shards.end())
+            continue;
+        ShardQuery& shard_query = state->shards[*it];
+        shard_query.query = new Query(*query);
+        mShards[*it]->registerQuery(shard_query.query);
+    }
+}
+
+void ShardedQueryHandler::removeShardQuery(QueryState* state, ShardQueryMap::iterator it) {
+    if (!it->second.results.empty())
+        state->dirty = true;
+    // Deleting the copy removes it from the shard's handler
+    delete it->second.query;
+    state->shards.erase(it);
+}
+
+void ShardedQueryHandler::tick(const Time& t) {
+    migrateObjects(t);
+    for(QueryMap::iterator it = mQueries.begin(); it != mQueries.end(); it++)
+        updateFanOut(it->first, it->second, t);
+
+    tickShards(t, NULL);
+
+    for(QueryMap::iterator it = mQueries.begin(); it != mQueries.end(); it++)
+        deliverResults(it->first, it->second, t);
+    mMigrated.clear();
+
+    mLastTime = t;
+}
+
+void ShardedQueryHandler::tick(const Time& t, const Duration& budget) {
+    // The shards run in parallel, so each gets the whole budget
+    migrateObjects(t);
+    for(QueryMap::iterator it = mQueries.begin(); it != mQueries.end(); it++)
+        updateFanOut(it->first, it->second, t);
+
+    tickShards(t, &budget);
+
+    for(QueryMap::iterator it = mQueries.begin(); it != mQueries.end(); it++)
+        deliverResults(it->first, it->second, t);
+    mMigrated.clear();
+
+    mLastTime = t;
+}
+
+Duration ShardedQueryHandler::staleness(const Query* query, const Time& t) const {
+    QueryMap::const_iterator it = mQueries.find(const_cast<Query*>(query));
+    assert( it != mQueries.end() );
+
+    Duration result(0);
+    const QueryState* state = it->second;
+    for(ShardQueryMap::const_iterator shard_it = state->shards.begin(); shard_it != state->shards.end(); shard_it++) {
+        Duration shard_staleness = mShards[shard_it->first]->staleness(shard_it->second.query, t);
+        if (result < shard_staleness)
+            result = shard_staleness;
+    }
+    return result;
+}
+
+void ShardedQueryHandler::deliverResults(Query* query, QueryState* state, const Time& t) {
+    for(ShardQueryMap::iterator it = state->shards.begin(); it != state->shards.end(); it++) {
+        std::deque<QueryEvent> events;
+        it->second.query->popEvents(events);
+        for(std::deque<QueryEvent>::iterator evt_it = events.begin(); evt_it != events.end(); evt_it++) {
+            if (evt_it->type() == QueryEvent::Added)
+                it->second.results.insert(evt_it->id());
+            else
+                it->second.results.erase(evt_it->id());
+        }
+        if (!events.empty())
+            state->dirty = true;
+    }
+
+    // A member's new shard only admits it once it satisfies the entry
+    // thresholds, so members which migrated, or were already carried across a
+    // migration, need checking against the exit thresholds
+    IDSet carry_candidates;
+    carry_candidates.swap(state->carried);
+    for(IDSet::iterator it = mMigrated.begin(); it != mMigrated.end(); it++) {
+        if (state->cache.contains(*it))
+            carry_candidates.insert(*it);
+    }
+    if (!carry_candidates.empty())
+        state->dirty = true;
+
+    // Limited results can be reordered across shards without any shard's
+    // results changing, so they are re-ranked every tick
+    uint32 max_results = query->maxResults();
+    bool rerank = (max_results != 0 && state->shards.size() > 1);
+    if (!state->dirty && !rerank)
+        return;
+    state->dirty = false;
+
+    IDSet merged;
+    for(ShardQueryMap::iterator it = state->shards.begin(); it != state->shards.end(); it++)
+        merged.insert(it->second.results.begin(), it->second.results.end());
+
+    Vector3f qpos = query->position(t);
+    for(IDSet::iterator it = carry_candidates.begin(); it != carry_candidates.end(); it++) {
+        if (merged.find(*it) != merged.end())
+            continue;
+        ObjectIDMap::iterator obj_it = mObjectIDs.find(*it);
+        if (obj_it == mObjectIDs.end() || !Sharded_satisfies_exit(query, qpos, obj_it->second->worldBounds(t)))
+            continue;
+        merged.insert(*it);
+        state->carried.insert(*it);
+    }
+
+    QueryCache newcache;
+    if (max_results == 0 || merged.size() <= max_results) {
+        for(IDSet::iterator it = merged.begin(); it != merged.end(); it++)
+            newcache.add(*it);
+    }
+    else {
+        std::vector<RankedObject> ranked;
+        for(IDSet::iterator it = merged.begin(); it != merged.end(); it++) {
+            ObjectIDMap::iterator obj_it = mObjectIDs.find(*it);
+            if (obj_it == mObjectIDs.end())
+                continue;
+            ranked.push_back( RankedObject(QueryConstraints_rank_key(obj_it->second->worldBounds(t), qpos, query->ranking()), *it) );
+        }
+        if (ranked.size() > max_results) {
+            std::nth_element(ranked.begin(), ranked.begin() + max_results, ranked.end(), QueryConstraints_ranks_before);
+            ranked.erase(ranked.begin() + max_results, ranked.end());
+        }
+        for(uint32 i = 0; i < ranked.size(); i++)
+            newcache.add(ranked[i].id);
+    }
+
+    // Carried objects ranked out of the result have to re-enter normally
+    for(IDSet::iterator it = state->carried.begin(); it != state->carried.end(); ) {
+        IDSet::iterator cur = it++;
+        if (!newcache.contains(*cur))
+            state->carried.erase(cur);
+    }
+
+    std::deque<QueryEvent> events;
+    state->cache.exchange(newcache, &events);
+    if (!events.empty())
+        query->pushEvents(events);
+}
+
+void ShardedQueryHandler::tickShards(const Time& t, const Duration* budget) {
+    {
+        boost::mutex::scoped_lock lock(mWorkMutex);
+        mWorkTime = t;
+        mWorkBudgeted = (budget != NULL);
+        if (budget != NULL)
+            mWorkBudget = *budget;
+        mWorkRemaining = mShards.size();
+        mWorkGeneration++;
+    }
+    mWorkCondition.notify_all();
+
+    boost::mutex::scoped_lock lock(mWorkMutex);
+    while(mWorkRemaining > 0)
+        mDoneCondition.wait(lock);
+}
+
+void ShardedQueryHandler::workerMain(uint32 shard) {
+    uint32 generation = 0;
+    while(true) {
+        Time t(0);
+        Duration budget(0);
+        bool budgeted;
+        {
+            boost::mutex::scoped_lock lock(mWorkMutex);
+            while(!mShutdown && mWorkGeneration == generation)
+                mWorkCondition.wait(lock);
+            if (mShutdown)
+                return;
+            generation = mWorkGeneration;
+            t = mWorkTime;
+            budget = mWorkBudget;
+            budgeted = mWorkBudgeted;
+        }
+
+        if (budgeted)
+            mShards[shard]->tick(t, budget);
+        else
+            mShards[shard]->tick(t);
+
+        boost::mutex::scoped_lock lock(mWorkMutex);
+        if (--mWorkRemaining == 0)
+            mDoneCondition.notify_one();
+    }
+}
+
+void ShardedQueryHandler::objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos) {
+    ObjectMap::iterator it = mObjects.find(obj);
+    assert( it != mObjects.end() );
+    it->second.copy->position(new_pos);
+    // Objects which have already left their shard are migrated next tick
+    scheduleMigration(obj, &it->second, mLastTime);
+}
+
+void ShardedQueryHandler::objectsPositionUpdated(const ObjectPositionUpdate* updates, std::size_t count) {
+    std::vector<Object*> copies;
+    std::vector<MotionVector3f> positions;
+    copies.reserve(count);
+    positions.reserve(count);
+    for(std::size_t i = 0; i < count; i++) {
+        ObjectMap::iterator it = mObjects.find(updates[i].object);
+        assert( it != mObjects.end() );
+        copies.push_back(it->second.copy);
+        positions.push_back(updates[i].new_pos);
+    }
+    if (count > 0)
+        Object::updatePositions(&copies[0], &positions[0], count);
+
+    for(std::size_t i = 0; i < count; i++)
+        scheduleMigration(updates[i].object, &mObjects[updates[i].object], mLastTime);
+}
+
+void ShardedQueryHandler::objectBoundingSphereUpdated(Object* obj, const BoundingSphere3f& old_bounds, const BoundingSphere3f& new_bounds) {
+    ObjectMap::iterator it = mObjects.find(obj);
+    assert( it != mObjects.end() );
+    it->second.copy->bounds(new_bounds);
+    scheduleMigration(obj, &it->second, mLastTime);
+}
+
+void ShardedQueryHandler::objectDeleted(const Object* obj) {
+    ObjectMap::iterator it = mObjects.find(const_cast<Object*>(obj));
+    assert( it != mObjects.end() );
+    unscheduleMigration(&it->second);
+    delete it->second.copy;
+    ObjectIDMap::iterator id_it = mObjectIDs.find(obj->id());
+    if (id_it != mObjectIDs.end() && id_it->second == obj)
+        mObjectIDs.erase(id_it);
+    mObjects.erase(it);
+    const_cast<Object*>(obj)->removeChangeListener(this);
+}
+
+void ShardedQueryHandler::queryPositionUpdated(Query* query, const MotionVector3f& old_pos, const MotionVector3f& new_pos) {
+    // The shards the query reaches are updated next tick
+    QueryMap::iterator it = mQueries.find(query);
+    assert( it != mQueries.end() );
+    for(ShardQueryMap::iterator shard_it = it->second->shards.begin(); shard_it != it->second->shards.end(); shard_it++)
+        shard_it->second.query->position(new_pos);
+}
+
+void ShardedQueryHandler::queryFrustumUpdated(Query* query, const Frustum& old_frustum, const Frustum& new_frustum) {
+    QueryMap::iterator it = mQueries.find(query);
+    assert( it != mQueries.end() );
+    for(ShardQueryMap::iterator shard_it = it->second->shards.begin(); shard_it != it->second->shards.end(); shard_it++)
+        shard_it->second.query->frustum(new_frustum);
+}
+
+void ShardedQueryHandler::queryDeleted(const Query* query) {
+    QueryMap::iterator it = mQueries.find(const_cast<Query*>(query));
+    assert( it != mQueries.end() );
+    QueryState* state = it->second;
+    for(ShardQueryMap::iterator shard_it = state->shards.begin(); shard_it != state->shards.end(); shard_it++)
+        delete shard_it->second.query;
+    delete state;
+    mQueries.erase(it);
+}
+
+} // namespace Prox
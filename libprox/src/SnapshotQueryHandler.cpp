@@ -0,0 +1,320 @@
+/*  libprox
+ *  SnapshotQueryHandler.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <prox/SnapshotQueryHandler.hpp>
+#include <prox/QueryConstraints.hpp>
+#include <prox/BoundingSphere.hpp>
+#include <prox/Timer.hpp>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cmath>
+#include <float.h>
+#include <algorithm>
+
+namespace Prox {
+
+static BoundingSphere3f Snapshot_bounds(const float* center, float radius) {
+    return BoundingSphere3f( Vector3f(center[0], center[1], center[2]), radius );
+}
+
+static ObjectID Snapshot_object_id(const RTreeSnapshotObject& obj) {
+    return ObjectID(obj.id, ObjectID::static_size);
+}
+
+// Returns true if every node's children lie within the node and object
+// arrays.  Internal nodes must also come before their children, as they do in
+// the breadth first order the writer uses, so traversals can't loop.
+static bool Snapshot_valid_nodes(const RTreeSnapshotNode* nodes, uint32 node_count, uint32 object_count) {
+    for(uint32 i = 0; i < node_count; i++) {
+        const RTreeSnapshotNode& node = nodes[i];
+        uint64 end = (uint64)node.firstChild + node.count;
+        if (node.leaf) {
+            if (end > object_count)
+                return false;
+        }
+        else {
+            if (end > node_count || (node.count > 0 && node.firstChild <= i))
+                return false;
+        }
+    }
+    return true;
+}
+
+SnapshotQueryHandler::SnapshotQueryHandler(const std::string& path)
+ : QueryHandler(),
+   QueryChangeListener(),
+   mMapping(NULL),
+   mMappingSize(0),
+   mHeader(NULL),
+   mNodes(NULL),
+   mObjects(NULL),
+   mLastTime(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && (std::size_t)info.st_size >= sizeof(RTreeSnapshotHeader)) {
+        void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            mMapping = mapping;
+            mMappingSize = info.st_size;
+        }
+    }
+    close(fd);
+    if (mMapping == NULL)
+        return;
+
+    const RTreeSnapshotHeader* header = (const RTreeSnapshotHeader*)mMapping;
+    std::size_t expected_size = sizeof(RTreeSnapshotHeader) +
+        (std::size_t)header->nodeCount * sizeof(RTreeSnapshotNode) +
+        (std::size_t)header->objectCount * sizeof(RTreeSnapshotObject);
+    if (std::memcmp(header->magic, RTreeSnapshot_magic, sizeof(header->magic)) != 0 ||
+        header->byteOrder != RTreeSnapshot_byte_order ||
+        header->version != RTreeSnapshot_version ||
+        header->nodeCount == 0 ||
+        expected_size > mMappingSize)
+        return;
+
+    const RTreeSnapshotNode* nodes = (const RTreeSnapshotNode*)(header + 1);
+    if (!Snapshot_valid_nodes(nodes, header->nodeCount, header->objectCount))
+        return;
+
+    mHeader = header;
+    mNodes = nodes;
+    mObjects = (const RTreeSnapshotObject*)(mNodes + header->nodeCount);
+}
+
+SnapshotQueryHandler::~SnapshotQueryHandler() {
+    for(QueryMap::iterator it = mQueries.begin(); it != mQueries.end(); it++) {
+        it->first->removeChangeListener(this);
+        delete it->second;
+    }
+    mQueries.clear();
+
+    if (mMapping != NULL)
+        munmap(mMapping, mMappingSize);
+}
+
+bool SnapshotQueryHandler::valid() const {
+    return (mHeader != NULL);
+}
+
+uint32 SnapshotQueryHandler::objectCount() const {
+    return valid() ? mHeader->objectCount : 0;
+}
+
+void SnapshotQueryHandler::registerObject(Object* obj) {
+    assert(false);
+}
+
+void SnapshotQueryHandler::registerQuery(Query* query) {
+    QueryState* state = new QueryState;
+    mQueries[query] = state;
+    mScheduler.addQuery(query, mLastTime);
+    query->addChangeListener(this);
+}
+
+void SnapshotQueryHandler::tick(const Time& t) {
+    std::vector<Query*> due;
+    uint32 nrequired;
+    mScheduler.schedule(t, &due, &nrequired);
+    for(uint32 i = 0; i < due.size(); i++) {
+        QueryState* state = mQueries[due[i]];
+        if (state->exact) {
+            mScheduler.evaluated(due[i], t, 0);
+            continue;
+        }
+        evaluateQuery(due[i], state, t);
+    }
+
+    mLastTime = t;
+}
+
+void SnapshotQueryHandler::tick(const Time& t, const Duration& budget) {
+    Timer timer;
+    timer.start();
+
+    std::vector<Query*> due;
+    uint32 nrequired;
+    mScheduler.schedule(t, &due, &nrequired);
+    for(uint32 i = 0; i < due.size(); i++) {
+        if (i >= nrequired && i > 0 && !(timer.elapsed() < budget))
+            break;
+        QueryState* state = mQueries[due[i]];
+        if (state->exact) {
+            mScheduler.evaluated(due[i], t, 0);
+            continue;
+        }
+        evaluateQuery(due[i], state, t);
+    }
+
+    mLastTime = t;
+}
+
+Duration SnapshotQueryHandler::staleness(const Query* query, const Time& t) const {
+    return mScheduler.staleness(query, t);
+}
+
+void SnapshotQueryHandler::evaluateQuery(Query* query, QueryState* state, const Time& t) {
+    QueryCache newcache;
+    if (valid()) {
+        if (query->maxResults() == 0)
+            collectAll(query, state, t, &newcache);
+        else
+            collectRanked(query, state, t, &newcache);
+    }
+
+    std::deque<QueryEvent> events;
+    state->cache.exchange(newcache, &events);
+    mScheduler.evaluated(query, t, events.size());
+    // Nothing in the snapshot moves, so only the query can change the result
+    state->exact = (query->position().velocity().lengthSquared() == 0.f);
+
+    query->pushEvents(events);
+}
+
+void SnapshotQueryHandler::collectAll(Query* query, QueryState* state, const Time& t, QueryCache* newcache) {
+    Vector3f qpos = query->position(t);
+    float qradius = query->radius();
+    float qangle_ratio = query->angle().maxDistanceRatioSquared();
+    float qexit_radius = query->exitRadius();
+    float qexit_angle_ratio = query->exitAngle().maxDistanceRatioSquared();
+    const Frustum& qfrustum = query->frustum();
+
+    std::stack<uint32> node_stack;
+    node_stack.push(0);
+    while(!node_stack.empty()) {
+        const RTreeSnapshotNode& node = mNodes[node_stack.top()];
+        node_stack.pop();
+
+        for(uint32 i = node.firstChild; i < node.firstChild + node.count; i++) {
+            if (node.leaf) {
+                const RTreeSnapshotObject& obj = mObjects[i];
+                ObjectID id = Snapshot_object_id(obj);
+                bool member = state->cache.contains(id);
+                BoundingSphere3f obounds = Snapshot_bounds(obj.center, obj.radius);
+                if (QueryConstraints_satisfied(qpos, member ? qexit_radius : qradius, member ? qexit_angle_ratio : qangle_ratio, obounds) &&
+                    qfrustum.intersects(qpos, obounds))
+                    newcache->add(id);
+            }
+            else {
+                BoundingSphere3f nbounds = Snapshot_bounds(mNodes[i].center, mNodes[i].radius);
+                if (QueryConstraints_node_satisfied(qpos, qexit_radius, qexit_angle_ratio, nbounds) &&
+                    qfrustum.intersects(qpos, nbounds))
+                    node_stack.push(i);
+            }
+        }
+    }
+}
+
+void SnapshotQueryHandler::collectRanked(Query* query, QueryState* state, const Time& t, QueryCache* newcache) {
+    Vector3f qpos = query->position(t);
+    float qradius = query->radius();
+    float qangle_ratio = query->angle().maxDistanceRatioSquared();
+    float qexit_radius = query->exitRadius();
+    float qexit_angle_ratio = query->exitAngle().maxDistanceRatioSquared();
+    const Frustum& qfrustum = query->frustum();
+    uint32 max_results = query->maxResults();
+    Query::Ranking ranking = query->ranking();
+
+    // Best-first traversal, see RTreeQueryHandler::collectRanked
+    typedef std::pair<float, uint32> NodeEntry;
+    std::priority_queue<NodeEntry> node_queue;
+    node_queue.push( NodeEntry(QueryConstraints_rank_key(Snapshot_bounds(mNodes[0].center, mNodes[0].radius), qpos, ranking), 0) );
+
+    std::vector<RankedObject> best;
+    while(!node_queue.empty()) {
+        NodeEntry entry = node_queue.top();
+        node_queue.pop();
+        if (best.size() == max_results && entry.first < best.front().key)
+            break;
+
+        const RTreeSnapshotNode& node = mNodes[entry.second];
+        for(uint32 i = node.firstChild; i < node.firstChild + node.count; i++) {
+            if (node.leaf) {
+                const RTreeSnapshotObject& obj = mObjects[i];
+                ObjectID id = Snapshot_object_id(obj);
+                bool member = state->cache.contains(id);
+                BoundingSphere3f obounds = Snapshot_bounds(obj.center, obj.radius);
+                if (!QueryConstraints_satisfied(qpos, member ? qexit_radius : qradius, member ? qexit_angle_ratio : qangle_ratio, obounds) ||
+                    !qfrustum.intersects(qpos, obounds))
+                    continue;
+
+                RankedObject candidate(QueryConstraints_rank_key(obounds, qpos, ranking), id);
+                if (best.size() == max_results) {
+                    if (!QueryConstraints_ranks_before(candidate, best.front()))
+                        continue;
+                    std::pop_heap(best.begin(), best.end(), QueryConstraints_ranks_before);
+                    best.pop_back();
+                }
+                best.push_back(candidate);
+                std::push_heap(best.begin(), best.end(), QueryConstraints_ranks_before);
+            }
+            else {
+                BoundingSphere3f nbounds = Snapshot_bounds(mNodes[i].center, mNodes[i].radius);
+                if (QueryConstraints_node_satisfied(qpos, qexit_radius, qexit_angle_ratio, nbounds) &&
+                    qfrustum.intersects(qpos, nbounds))
+                    node_queue.push( NodeEntry(QueryConstraints_rank_key(nbounds, qpos, ranking), i) );
+            }
+        }
+    }
+
+    for(uint32 i = 0; i < best.size(); i++)
+        newcache->add(best[i].id);
+}
+
+void SnapshotQueryHandler::queryPositionUpdated(Query* query, const MotionVector3f& old_pos, const MotionVector3f& new_pos) {
+    QueryMap::iterator it = mQueries.find(query);
+    assert( it != mQueries.end() );
+    it->second->exact = false;
+}
+
+void SnapshotQueryHandler::queryFrustumUpdated(Query* query, const Frustum& old_frustum, const Frustum& new_frustum) {
+    QueryMap::iterator it = mQueries.find(query);
+    assert( it != mQueries.end() );
+    it->second->exact = false;
+}
+
+void SnapshotQueryHandler::queryDeleted(const Query* query) {
+    QueryMap::iterator it = mQueries.find(const_cast<Query*>(query));
+    assert( it != mQueries.end() );
+    delete it->second;
+    mQueries.erase(it);
+    mScheduler.removeQuery(query);
+}
+
+} // namespace Prox
@@ -33,6 +33,7 @@
 #include <prox/SolidAngle.hpp>
 #include <cassert>
 #include <cmath>
+#include <float.h>
 
 namespace Prox {
 const float SolidAngle::Pi = 3.1415926536f;
@@ -73,15 +74,24 @@ SolidAngle SolidAngle::fromRadius(const ArcAngle& al) {
 }
 
 SolidAngle SolidAngle::fromCenterRadius(const Vector3f& to_center, float radius) {
-
-    Vector3f ortho_to_obj = to_center.cross( Vector3f(1.f, 1.f, 1.f) ).normal(); // FIXME this could break in some cases
-    Vector3f to_bound = to_center + ortho_to_obj * radius;
-    Vector3f norm_to_center = to_center.normal();
-    to_bound.normalizeThis();
-    return SolidAngle( 2.0f * Pi * (1.0f - norm_to_center.dot(to_bound)) );
-/*
-    return SolidAngle( 2.f * Pi * (1.f-cos(atan(radius/to_center.length()))) );
-*/
+    // The cosine of the angle between the center and a point offset
+    // orthogonally by radius, i.e. cos(atan(radius/dist)).
+    float dist_sq = to_center.lengthSquared();
+    float hyp_sq = dist_sq + radius * radius;
+    if (hyp_sq <= 0.f)
+        return Min;
+    return SolidAngle( 2.0f * Pi * (1.0f - sqrt(dist_sq / hyp_sq)) );
+}
+
+float SolidAngle::maxDistanceRatioSquared() const {
+    // fromCenterRadius gives 2*Pi*(1 - d/sqrt(d^2+r^2)), so with
+    // c = 1 - mSolidAngle/(2*Pi) the test is d^2 <= c^2/(1-c^2) * r^2.
+    float c = 1.0f - mSolidAngle / (2.0f * Pi);
+    if (c >= 1.0f)
+        return FLT_MAX;
+    if (c <= 0.0f)
+        return 0.0f;
+    return (c * c) / (1.0f - c * c);
 }
 
 SolidAngle SolidAngle::operator+(const SolidAngle& rhs) const {
@@ -48,6 +48,10 @@ Time::Time(const Time& cpy)
 Time::~Time() {
 }
 
+uint64 Time::microseconds() const {
+    return mSinceEpoch;
+}
+
 Time Time::operator+(const Duration& dt) const {
     return Time(mSinceEpoch + dt.mMicrosecs);
 }
@@ -1,4 +1,4 @@
-/*  proxsim
+/*  libprox
  *  Timer.cpp
  *
  *  Copyright (c) 2009, Ewen Cheslack-Postava
@@ -30,11 +30,9 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include "Timer.hpp"
+#include <prox/Timer.hpp>
 
-using namespace Prox;
-
-namespace ProxSim {
+namespace Prox {
 
 Timer::Timer() {
 }
@@ -57,4 +55,4 @@ Duration Timer::elapsed() {
 }
 
 
-} // namespace ProxSim
+} // namespace Prox
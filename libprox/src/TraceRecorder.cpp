@@ -0,0 +1,247 @@
+/*  libprox
+ *  TraceRecorder.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <prox/TraceRecorder.hpp>
+#include <prox/Trace.hpp>
+
+namespace Prox {
+
+TraceRecorder::TraceRecorder(QueryHandler* inner, const std::string& path)
+ : QueryHandler(),
+   ObjectChangeListener(),
+   QueryChangeListener(),
+   mInner(inner),
+   mFile(NULL),
+   mValid(false),
+   mObjectCount(0),
+   mQueryCount(0)
+{
+    mFile = fopen(path.c_str(), "wb");
+    if (mFile == NULL)
+        return;
+    mValid = true;
+
+    mBuffer.insert(mBuffer.end(), Trace_magic, Trace_magic + sizeof(Trace_magic));
+    writeUInt32(Trace_version);
+    flush();
+}
+
+TraceRecorder::~TraceRecorder() {
+    for(ObjectIndexMap::iterator it = mObjectIndices.begin(); it != mObjectIndices.end(); it++)
+        const_cast<Object*>(it->first)->removeChangeListener(this);
+    mObjectIndices.clear();
+    for(QueryIndexMap::iterator it = mQueryIndices.begin(); it != mQueryIndices.end(); it++)
+        const_cast<Query*>(it->first)->removeChangeListener(this);
+    mQueryIndices.clear();
+
+    if (mFile != NULL) {
+        flush();
+        fclose(mFile);
+    }
+
+    delete mInner;
+}
+
+bool TraceRecorder::valid() const {
+    return mValid;
+}
+
+void TraceRecorder::registerObject(Object* obj) {
+    uint32 idx = mObjectCount++;
+    mObjectIndices[obj] = idx;
+
+    writeUInt8(Trace_ObjectRegistered);
+    writeUInt32(idx);
+    mBuffer.insert(mBuffer.end(), (const uint8*)obj->id().begin(), (const uint8*)obj->id().end());
+    writeMotion(obj->position());
+    writeBounds(obj->bounds());
+
+    obj->addChangeListener(this);
+    mInner->registerObject(obj);
+}
+
+void TraceRecorder::registerQuery(Query* query) {
+    uint32 idx = mQueryCount++;
+    mQueryIndices[query] = idx;
+
+    writeUInt8(Trace_QueryRegistered);
+    writeUInt32(idx);
+    writeMotion(query->position());
+    writeFloat(query->angle().asFloat());
+    writeFloat(query->radius());
+    writeFloat(query->exitAngle().asFloat());
+    writeFloat(query->exitRadius());
+    writeUInt64(query->maxStaleness().microseconds());
+    writeUInt32(query->maxResults());
+    writeUInt8(query->ranking());
+    writeFrustum(query->frustum());
+
+    query->addChangeListener(this);
+    mInner->registerQuery(query);
+}
+
+void TraceRecorder::tick(const Time& t) {
+    writeUInt8(Trace_Tick);
+    writeUInt64(t.microseconds());
+    flush();
+
+    mInner->tick(t);
+}
+
+void TraceRecorder::tick(const Time& t, const Duration& budget) {
+    writeUInt8(Trace_BudgetedTick);
+    writeUInt64(t.microseconds());
+    writeUInt64(budget.microseconds());
+    flush();
+
+    mInner->tick(t, budget);
+}
+
+Duration TraceRecorder::staleness(const Query* query, const Time& t) const {
+    return mInner->staleness(query, t);
+}
+
+void TraceRecorder::objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos) {
+    ObjectIndexMap::iterator it = mObjectIndices.find(obj);
+    assert( it != mObjectIndices.end() );
+    writeUInt8(Trace_ObjectMoved);
+    writeUInt32(it->second);
+    writeMotion(new_pos);
+}
+
+void TraceRecorder::objectsPositionUpdated(const ObjectPositionUpdate* updates, std::size_t count) {
+    // Recorded as a batch so the replay makes the same batched call
+    writeUInt8(Trace_ObjectsMoved);
+    writeUInt32(count);
+    for(std::size_t i = 0; i < count; i++) {
+        ObjectIndexMap::iterator it = mObjectIndices.find(updates[i].object);
+        assert( it != mObjectIndices.end() );
+        writeUInt32(it->second);
+        writeMotion(updates[i].new_pos);
+    }
+}
+
+void TraceRecorder::objectBoundingSphereUpdated(Object* obj, const BoundingSphere3f& old_bounds, const BoundingSphere3f& new_bounds) {
+    ObjectIndexMap::iterator it = mObjectIndices.find(obj);
+    assert( it != mObjectIndices.end() );
+    writeUInt8(Trace_ObjectResized);
+    writeUInt32(it->second);
+    writeBounds(new_bounds);
+}
+
+void TraceRecorder::objectDeleted(const Object* obj) {
+    ObjectIndexMap::iterator it = mObjectIndices.find(obj);
+    assert( it != mObjectIndices.end() );
+    writeUInt8(Trace_ObjectDeleted);
+    writeUInt32(it->second);
+    mObjectIndices.erase(it);
+    const_cast<Object*>(obj)->removeChangeListener(this);
+}
+
+void TraceRecorder::queryPositionUpdated(Query* query, const MotionVector3f& old_pos, const MotionVector3f& new_pos) {
+    QueryIndexMap::iterator it = mQueryIndices.find(query);
+    assert( it != mQueryIndices.end() );
+    writeUInt8(Trace_QueryMoved);
+    writeUInt32(it->second);
+    writeMotion(new_pos);
+}
+
+void TraceRecorder::queryFrustumUpdated(Query* query, const Frustum& old_frustum, const Frustum& new_frustum) {
+    QueryIndexMap::iterator it = mQueryIndices.find(query);
+    assert( it != mQueryIndices.end() );
+    writeUInt8(Trace_QueryFrustum);
+    writeUInt32(it->second);
+    writeFrustum(new_frustum);
+}
+
+void TraceRecorder::queryDeleted(const Query* query) {
+    QueryIndexMap::iterator it = mQueryIndices.find(query);
+    assert( it != mQueryIndices.end() );
+    writeUInt8(Trace_QueryDeleted);
+    writeUInt32(it->second);
+    mQueryIndices.erase(it);
+}
+
+void TraceRecorder::writeUInt8(uint8 v) {
+    mBuffer.push_back(v);
+}
+
+void TraceRecorder::writeUInt32(uint32 v) {
+    for(std::size_t i = 0; i < 4; i++)
+        mBuffer.push_back( (uint8)(v >> (8*i)) );
+}
+
+void TraceRecorder::writeUInt64(uint64 v) {
+    for(std::size_t i = 0; i < 8; i++)
+        mBuffer.push_back( (uint8)(v >> (8*i)) );
+}
+
+void TraceRecorder::writeFloat(float v) {
+    uint32 bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    writeUInt32(bits);
+}
+
+void TraceRecorder::writeVector(const Vector3f& v) {
+    writeFloat(v.x);
+    writeFloat(v.y);
+    writeFloat(v.z);
+}
+
+void TraceRecorder::writeMotion(const MotionVector3f& motion) {
+    writeUInt64(motion.updateTime().microseconds());
+    writeVector(motion.position());
+    writeVector(motion.velocity());
+}
+
+void TraceRecorder::writeBounds(const BoundingSphere3f& bounds) {
+    writeVector(bounds.center());
+    writeFloat(bounds.radius());
+}
+
+void TraceRecorder::writeFrustum(const Frustum& frustum) {
+    writeUInt8(frustum.planeCount());
+    for(int i = 0; i < frustum.planeCount(); i++) {
+        writeVector(frustum.planeNormal(i));
+        writeFloat(frustum.planeOffset(i));
+    }
+}
+
+void TraceRecorder::flush() {
+    if (mFile != NULL && !mBuffer.empty()) {
+        if (fwrite(&mBuffer[0], 1, mBuffer.size(), mFile) != mBuffer.size())
+            mValid = false;
+    }
+    mBuffer.clear();
+}
+
+} // namespace Prox
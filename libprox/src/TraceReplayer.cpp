@@ -0,0 +1,343 @@
+/*  libprox
+ *  TraceReplayer.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <prox/TraceReplayer.hpp>
+#include <prox/Trace.hpp>
+#include <cstdio>
+#include <cstring>
+
+namespace Prox {
+
+TraceReplayer::TraceReplayer(const std::string& path)
+ : mOffset(0),
+   mValid(false),
+   mFinished(true),
+   mTime(0),
+   mEventCount(0)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return;
+    uint8 buffer[65536];
+    std::size_t n;
+    while( (n = fread(buffer, 1, sizeof(buffer), file)) > 0 )
+        mData.insert(mData.end(), buffer, buffer + n);
+    fclose(file);
+
+    uint32 version;
+    if (mData.size() < sizeof(Trace_magic) || std::memcmp(&mData[0], Trace_magic, sizeof(Trace_magic)) != 0)
+        return;
+    mOffset = sizeof(Trace_magic);
+    if (!readUInt32(&version) || version != Trace_version)
+        return;
+
+    mValid = true;
+    mFinished = false;
+}
+
+TraceReplayer::~TraceReplayer() {
+    for(uint32 i = 0; i < mQueries.size(); i++)
+        delete mQueries[i];
+    for(uint32 i = 0; i < mObjects.size(); i++)
+        delete mObjects[i];
+}
+
+bool TraceReplayer::valid() const {
+    return mValid;
+}
+
+bool TraceReplayer::finished() const {
+    return mFinished;
+}
+
+const Time& TraceReplayer::time() const {
+    return mTime;
+}
+
+uint64 TraceReplayer::eventCount() const {
+    return mEventCount;
+}
+
+uint32 TraceReplayer::queryCount() const {
+    return mQueries.size();
+}
+
+bool TraceReplayer::applyUpdates(QueryHandler* handler) {
+    while(!mFinished) {
+        if (mOffset == mData.size()) {
+            mFinished = true;
+            break;
+        }
+        if (mData[mOffset] == Trace_Tick || mData[mOffset] == Trace_BudgetedTick)
+            return true;
+        bool ticked = false;
+        if (!replayRecord(handler, &ticked)) {
+            mFinished = true;
+            break;
+        }
+    }
+    return false;
+}
+
+bool TraceReplayer::step(QueryHandler* handler) {
+    while(!mFinished) {
+        bool ticked = false;
+        if (mOffset == mData.size() || !replayRecord(handler, &ticked)) {
+            mFinished = true;
+            break;
+        }
+        if (ticked) {
+            collectEvents();
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32 TraceReplayer::run(QueryHandler* handler) {
+    uint32 nticks = 0;
+    while(step(handler))
+        nticks++;
+    return nticks;
+}
+
+Object* TraceReplayer::object(uint32 idx) const {
+    return (idx < mObjects.size()) ? mObjects[idx] : NULL;
+}
+
+Query* TraceReplayer::query(uint32 idx) const {
+    return (idx < mQueries.size()) ? mQueries[idx] : NULL;
+}
+
+void TraceReplayer::collectEvents() {
+    for(uint32 i = 0; i < mQueries.size(); i++) {
+        if (mQueries[i] == NULL)
+            continue;
+        std::deque<QueryEvent> events;
+        mQueries[i]->popEvents(events);
+        mEventCount += events.size();
+    }
+}
+
+bool TraceReplayer::replayRecord(QueryHandler* handler, bool* ticked) {
+    uint8 type;
+    uint32 idx;
+    MotionVector3f motion(Time(0), Vector3f(0, 0, 0), Vector3f(0, 0, 0));
+    BoundingSphere3f bounds;
+    if (!readUInt8(&type))
+        return false;
+
+    switch(type) {
+      case Trace_ObjectRegistered:
+        {
+            if (!readUInt32(&idx) || idx != mObjects.size() || mData.size() - mOffset < ObjectID::static_size)
+                return false;
+            ObjectID id(&mData[mOffset], ObjectID::static_size);
+            mOffset += ObjectID::static_size;
+            if (!readMotion(&motion) || !readBounds(&bounds))
+                return false;
+            Object* obj = new Object(id, motion, bounds);
+            mObjects.push_back(obj);
+            handler->registerObject(obj);
+        }
+        return true;
+      case Trace_ObjectMoved:
+        if (!readUInt32(&idx) || object(idx) == NULL || !readMotion(&motion))
+            return false;
+        object(idx)->position(motion);
+        return true;
+      case Trace_ObjectsMoved:
+        {
+            uint32 count;
+            if (!readUInt32(&count))
+                return false;
+            std::vector<Object*> objs;
+            std::vector<MotionVector3f> positions;
+            for(uint32 i = 0; i < count; i++) {
+                if (!readUInt32(&idx) || object(idx) == NULL || !readMotion(&motion))
+                    return false;
+                objs.push_back(object(idx));
+                positions.push_back(motion);
+            }
+            if (count > 0)
+                Object::updatePositions(&objs[0], &positions[0], count);
+        }
+        return true;
+      case Trace_ObjectResized:
+        if (!readUInt32(&idx) || object(idx) == NULL || !readBounds(&bounds))
+            return false;
+        object(idx)->bounds(bounds);
+        return true;
+      case Trace_ObjectDeleted:
+        if (!readUInt32(&idx) || object(idx) == NULL)
+            return false;
+        delete mObjects[idx];
+        mObjects[idx] = NULL;
+        return true;
+      case Trace_QueryRegistered:
+        {
+            float angle, radius, exit_angle, exit_radius;
+            uint64 max_staleness;
+            uint32 max_results;
+            uint8 ranking;
+            Frustum frustum;
+            if (!readUInt32(&idx) || idx != mQueries.size() || !readMotion(&motion) ||
+                !readFloat(&angle) || !readFloat(&radius) || !readFloat(&exit_angle) || !readFloat(&exit_radius) ||
+                !readUInt64(&max_staleness) || !readUInt32(&max_results) || !readUInt8(&ranking) || !readFrustum(&frustum))
+                return false;
+            // Query asserts on an exit band narrower than the entry thresholds
+            // and the ranking must be known, so reject them as malformed
+            if (SolidAngle(angle) < SolidAngle(exit_angle) || !(exit_radius >= radius) || ranking > Query::Nearest)
+                return false;
+            Query* query = new Query(motion, SolidAngle(angle), radius);
+            query->hysteresis(SolidAngle(exit_angle), exit_radius);
+            query->maxStaleness(Duration(max_staleness));
+            query->maxResults(max_results);
+            query->ranking( (Query::Ranking)ranking );
+            query->frustum(frustum);
+            mQueries.push_back(query);
+            handler->registerQuery(query);
+        }
+        return true;
+      case Trace_QueryMoved:
+        if (!readUInt32(&idx) || query(idx) == NULL || !readMotion(&motion))
+            return false;
+        query(idx)->position(motion);
+        return true;
+      case Trace_QueryFrustum:
+        {
+            Frustum frustum;
+            if (!readUInt32(&idx) || query(idx) == NULL || !readFrustum(&frustum))
+                return false;
+            query(idx)->frustum(frustum);
+        }
+        return true;
+      case Trace_QueryDeleted:
+        if (!readUInt32(&idx) || query(idx) == NULL)
+            return false;
+        delete mQueries[idx];
+        mQueries[idx] = NULL;
+        return true;
+      case Trace_Tick:
+        {
+            uint64 t;
+            if (!readUInt64(&t))
+                return false;
+            mTime = Time(t);
+            handler->tick(mTime);
+            *ticked = true;
+        }
+        return true;
+      case Trace_BudgetedTick:
+        {
+            uint64 t, budget;
+            if (!readUInt64(&t) || !readUInt64(&budget))
+                return false;
+            mTime = Time(t);
+            handler->tick(mTime, Duration(budget));
+            *ticked = true;
+        }
+        return true;
+      default:
+        return false;
+    }
+}
+
+bool TraceReplayer::readUInt8(uint8* v) {
+    if (mData.size() - mOffset < 1)
+        return false;
+    *v = mData[mOffset++];
+    return true;
+}
+
+bool TraceReplayer::readUInt32(uint32* v) {
+    if (mData.size() - mOffset < 4)
+        return false;
+    *v = 0;
+    for(std::size_t i = 0; i < 4; i++)
+        *v |= ((uint32)mData[mOffset++]) << (8*i);
+    return true;
+}
+
+bool TraceReplayer::readUInt64(uint64* v) {
+    if (mData.size() - mOffset < 8)
+        return false;
+    *v = 0;
+    for(std::size_t i = 0; i < 8; i++)
+        *v |= ((uint64)mData[mOffset++]) << (8*i);
+    return true;
+}
+
+bool TraceReplayer::readFloat(float* v) {
+    uint32 bits;
+    if (!readUInt32(&bits))
+        return false;
+    std::memcpy(v, &bits, sizeof(bits));
+    return true;
+}
+
+bool TraceReplayer::readVector(Vector3f* v) {
+    return readFloat(&v->x) && readFloat(&v->y) && readFloat(&v->z);
+}
+
+bool TraceReplayer::readMotion(MotionVector3f* motion) {
+    uint64 t;
+    Vector3f pos, vel;
+    if (!readUInt64(&t) || !readVector(&pos) || !readVector(&vel))
+        return false;
+    *motion = MotionVector3f(Time(t), pos, vel);
+    return true;
+}
+
+bool TraceReplayer::readBounds(BoundingSphere3f* bounds) {
+    Vector3f center;
+    float radius;
+    if (!readVector(&center) || !readFloat(&radius))
+        return false;
+    *bounds = BoundingSphere3f(center, radius);
+    return true;
+}
+
+bool TraceReplayer::readFrustum(Frustum* frustum) {
+    uint8 count;
+    Vector3f normals[6];
+    float offsets[6];
+    if (!readUInt8(&count) || count > 6)
+        return false;
+    for(uint8 i = 0; i < count; i++)
+        if (!readVector(&normals[i]) || !readFloat(&offsets[i]))
+            return false;
+    *frustum = Frustum::fromPlanes(count, normals, offsets);
+    return true;
+}
+
+} // namespace Prox
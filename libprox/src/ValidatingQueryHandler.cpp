@@ -0,0 +1,245 @@
+/*  libprox
+ *  ValidatingQueryHandler.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <prox/ValidatingQueryHandler.hpp>
+#include <prox/QueryConstraints.hpp>
+#include <prox/Object.hpp>
+#include <algorithm>
+#include <iterator>
+
+namespace Prox {
+
+static const uint32 Validating_default_max_recorded = 10000;
+
+static void Validating_apply_events(const std::deque<QueryEvent>& evts, std::set<ObjectID>* results) {
+    for(std::deque<QueryEvent>::const_iterator it = evts.begin(); it != evts.end(); it++) {
+        if (it->type() == QueryEvent::Added)
+            results->insert(it->id());
+        else
+            results->erase(it->id());
+    }
+}
+
+ValidatingQueryHandler::ValidatingQueryHandler(QueryHandler* candidate)
+ : QueryHandler(),
+   ObjectChangeListener(),
+   QueryChangeListener(),
+   mCandidate(candidate),
+   mDivergenceCount(0),
+   mMaxRecorded(Validating_default_max_recorded)
+{
+}
+
+ValidatingQueryHandler::~ValidatingQueryHandler() {
+    for(QueryMap::iterator it = mQueries.begin(); it != mQueries.end(); it++) {
+        it->first->removeChangeListener(this);
+        // Deleting the copy removes it from the candidate
+        delete it->second->candidate;
+        delete it->second;
+    }
+    mQueries.clear();
+
+    for(ObjectSet::iterator it = mObjects.begin(); it != mObjects.end(); it++)
+        (*it)->removeChangeListener(this);
+    mObjects.clear();
+
+    delete mCandidate;
+}
+
+void ValidatingQueryHandler::registerObject(Object* obj) {
+    mCandidate->registerObject(obj);
+    mObjects.insert(obj);
+    obj->addChangeListener(this);
+}
+
+void ValidatingQueryHandler::registerQuery(Query* query) {
+    QueryState* state = new QueryState;
+    state->candidate = new Query(*query);
+    mQueries[query] = state;
+
+    mCandidate->registerQuery(state->candidate);
+    query->addChangeListener(this);
+}
+
+void ValidatingQueryHandler::tick(const Time& t) {
+    mCandidate->tick(t);
+
+    for(QueryMap::iterator it = mQueries.begin(); it != mQueries.end(); it++) {
+        evaluateReference(it->first, it->second, t);
+        collectResults(it->first, it->second);
+        compareResults(it->first, it->second, t);
+    }
+}
+
+void ValidatingQueryHandler::tick(const Time& t, const Duration& budget) {
+    // Only the candidate is held to the budget, queries it skips are stale
+    // and won't be compared
+    mCandidate->tick(t, budget);
+
+    for(QueryMap::iterator it = mQueries.begin(); it != mQueries.end(); it++) {
+        evaluateReference(it->first, it->second, t);
+        collectResults(it->first, it->second);
+        compareResults(it->first, it->second, t);
+    }
+}
+
+Duration ValidatingQueryHandler::staleness(const Query* query, const Time& t) const {
+    QueryMap::const_iterator it = mQueries.find(const_cast<Query*>(query));
+    assert( it != mQueries.end() );
+    return mCandidate->staleness(it->second->candidate, t);
+}
+
+void ValidatingQueryHandler::evaluateReference(Query* query, QueryState* state, const Time& t) {
+    Vector3f qpos = query->position(t);
+    const Frustum& qfrustum = query->frustum();
+    uint32 max_results = query->maxResults();
+
+    std::vector<RankedObject> ranked;
+    for(ObjectSet::iterator it = mObjects.begin(); it != mObjects.end(); it++) {
+        Object* obj = *it;
+        BoundingSphere3f bounds = obj->worldBounds(t);
+
+        // Objects already in the result only need to satisfy the exit
+        // thresholds.  The thresholds are tested with the shared definition,
+        // since how solid angles are compared is part of what a query means.
+        bool member = QueryConstraints_satisfied(qpos, query->radius(), query->angle().maxDistanceRatioSquared(), bounds) ||
+            (state->referenceResults.find(obj->id()) != state->referenceResults.end() &&
+                QueryConstraints_satisfied(qpos, query->exitRadius(), query->exitAngle().maxDistanceRatioSquared(), bounds));
+        if (!member || !qfrustum.intersects(qpos, bounds))
+            continue;
+        ranked.push_back( RankedObject(QueryConstraints_rank_key(bounds, qpos, query->ranking()), obj->id()) );
+    }
+
+    if (max_results != 0 && ranked.size() > max_results) {
+        std::sort(ranked.begin(), ranked.end(), QueryConstraints_ranks_before);
+        ranked.erase(ranked.begin() + max_results, ranked.end());
+    }
+
+    state->referenceResults.clear();
+    for(uint32 i = 0; i < ranked.size(); i++)
+        state->referenceResults.insert(ranked[i].id);
+}
+
+void ValidatingQueryHandler::collectResults(Query* query, QueryState* state) {
+    std::deque<QueryEvent> evts;
+    state->candidate->popEvents(evts);
+    Validating_apply_events(evts, &state->candidateResults);
+    if (!evts.empty())
+        query->pushEvents(evts);
+}
+
+void ValidatingQueryHandler::compareResults(Query* query, QueryState* state, const Time& t) {
+    if (Duration(0) < mCandidate->staleness(state->candidate, t))
+        return;
+
+    IDSet missed;
+    std::set_difference(
+        state->referenceResults.begin(), state->referenceResults.end(),
+        state->candidateResults.begin(), state->candidateResults.end(),
+        std::inserter(missed, missed.begin())
+    );
+    IDSet spurious;
+    std::set_difference(
+        state->candidateResults.begin(), state->candidateResults.end(),
+        state->referenceResults.begin(), state->referenceResults.end(),
+        std::inserter(spurious, spurious.begin())
+    );
+
+    for(IDSet::iterator it = missed.begin(); it != missed.end(); it++)
+        addDivergence( Divergence(t, query, *it, Divergence::Missed) );
+    for(IDSet::iterator it = spurious.begin(); it != spurious.end(); it++)
+        addDivergence( Divergence(t, query, *it, Divergence::Spurious) );
+}
+
+void ValidatingQueryHandler::addDivergence(const Divergence& div) {
+    mDivergenceCount++;
+    if (mDivergences.size() < mMaxRecorded)
+        mDivergences.push_back(div);
+}
+
+uint32 ValidatingQueryHandler::divergenceCount() const {
+    return mDivergenceCount;
+}
+
+const std::vector<ValidatingQueryHandler::Divergence>& ValidatingQueryHandler::divergences() const {
+    return mDivergences;
+}
+
+void ValidatingQueryHandler::clearDivergences() {
+    mDivergences.clear();
+}
+
+uint32 ValidatingQueryHandler::maxRecorded() const {
+    return mMaxRecorded;
+}
+
+void ValidatingQueryHandler::maxRecorded(uint32 max_recorded) {
+    mMaxRecorded = max_recorded;
+}
+
+void ValidatingQueryHandler::objectPositionUpdated(Object* obj, const MotionVector3f& old_pos, const MotionVector3f& new_pos) {
+    // Nothing to be done, the reference uses values directly from the object
+}
+
+void ValidatingQueryHandler::objectBoundingSphereUpdated(Object* obj, const BoundingSphere3f& old_bounds, const BoundingSphere3f& new_bounds) {
+    // Nothing to be done, the reference uses values directly from the object
+}
+
+void ValidatingQueryHandler::objectDeleted(const Object* obj) {
+    ObjectSet::iterator where = mObjects.find(const_cast<Object*>(obj));
+    assert( where != mObjects.end() );
+    (*where)->removeChangeListener(this);
+    mObjects.erase(where);
+}
+
+void ValidatingQueryHandler::queryPositionUpdated(Query* query, const MotionVector3f& old_pos, const MotionVector3f& new_pos) {
+    QueryMap::iterator it = mQueries.find(query);
+    assert( it != mQueries.end() );
+    it->second->candidate->position(new_pos);
+}
+
+void ValidatingQueryHandler::queryFrustumUpdated(Query* query, const Frustum& old_frustum, const Frustum& new_frustum) {
+    QueryMap::iterator it = mQueries.find(query);
+    assert( it != mQueries.end() );
+    it->second->candidate->frustum(new_frustum);
+}
+
+void ValidatingQueryHandler::queryDeleted(const Query* query) {
+    QueryMap::iterator it = mQueries.find(const_cast<Query*>(query));
+    assert( it != mQueries.end() );
+    QueryState* state = it->second;
+    delete state->candidate;
+    delete state;
+    mQueries.erase(it);
+}
+
+} // namespace Prox
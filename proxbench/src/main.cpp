@@ -0,0 +1,412 @@
+/*  proxbench
+ *  main.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Simulator.hpp"
+#include <prox/BruteForceQueryHandler.hpp>
+#include <prox/RTreeQueryHandler.hpp>
+#include <prox/DoubleBufferedQueryHandler.hpp>
+#include <prox/ShardedQueryHandler.hpp>
+#include <prox/ValidatingQueryHandler.hpp>
+#include <prox/TraceRecorder.hpp>
+#include <prox/TraceReplayer.hpp>
+#include <prox/Timer.hpp>
+
+#include <sys/resource.h>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+using namespace Prox;
+using namespace ProxSim;
+
+static const uint32 ProxBench_tick_ms = 50;
+// Number of divergences listed when validating
+static const uint32 ProxBench_max_reported_divergences = 10;
+
+static float randFloat() {
+    return float(rand()) / RAND_MAX;
+}
+
+struct BenchOptions {
+    BenchOptions()
+     : handler("rtree"),
+       workload("linear"),
+       positions("uniform"),
+       sizes("fixed"),
+       motion("drift"),
+       volume(false),
+       objects(1000),
+       queries(5),
+       ticks(1000),
+       fanout(4),
+       seed(1),
+       validate(false),
+       rebuildThreshold(0.f),
+       backgroundRebuild(false),
+       hysteresis(1.f)
+    {}
+
+    std::string handler;
+    std::string workload;
+    std::string positions;
+    std::string sizes;
+    std::string motion;
+    bool volume; // spread through the region rather than over its floor
+    int objects;
+    int queries;
+    int ticks;
+    int fanout; // elements per node for tree handlers
+    int seed;
+    bool validate; // compare every tick against a naive reference
+    float rebuildThreshold; // for the rtree handler, 0 to disable
+    bool backgroundRebuild;
+    float hysteresis; // exit solid angle as a fraction of the entry one
+    std::string record; // trace file to record the run to, if any
+    std::string replay; // trace file to replay instead of simulating, if any
+};
+
+static void usage() {
+    std::cerr << "Usage: proxbench [--handler bruteforce|rtree|doublebuffered|sharded] [--workload static|linear|wander]" << std::endl;
+    std::cerr << "                 [--objects N] [--queries N] [--ticks N] [--fanout N] [--seed N] [--validate 0|1]" << std::endl;
+    std::cerr << "                 [--rebuild-threshold F] [--background-rebuild 0|1]" << std::endl;
+    std::cerr << "                 [--positions uniform|clusters|hotspots] [--sizes fixed|pareto]" << std::endl;
+    std::cerr << "                 [--motion drift|bounded|waypoints] [--volume 0|1] [--hysteresis F]" << std::endl;
+    std::cerr << "                 [--record PATH] [--replay PATH]" << std::endl;
+    std::cerr << "Drives the simulator without a display and reports tick throughput, latency and memory." << std::endl;
+    std::cerr << "--record writes the run to a trace, and --replay runs a whole trace in place of the simulator." << std::endl;
+}
+
+static bool parseOptions(int argc, char** argv, BenchOptions* opts) {
+    for(int i = 1; i < argc; i++) {
+        if (i + 1 >= argc)
+            return false;
+        std::string name = argv[i];
+        const char* value = argv[++i];
+        if (name == "--handler") opts->handler = value;
+        else if (name == "--workload") opts->workload = value;
+        else if (name == "--objects") opts->objects = atoi(value);
+        else if (name == "--queries") opts->queries = atoi(value);
+        else if (name == "--ticks") opts->ticks = atoi(value);
+        else if (name == "--fanout") opts->fanout = atoi(value);
+        else if (name == "--seed") opts->seed = atoi(value);
+        else if (name == "--validate") opts->validate = (atoi(value) != 0);
+        else if (name == "--rebuild-threshold") opts->rebuildThreshold = atof(value);
+        else if (name == "--background-rebuild") opts->backgroundRebuild = (atoi(value) != 0);
+        else if (name == "--positions") opts->positions = value;
+        else if (name == "--sizes") opts->sizes = value;
+        else if (name == "--motion") opts->motion = value;
+        else if (name == "--volume") opts->volume = (atoi(value) != 0);
+        else if (name == "--hysteresis") opts->hysteresis = atof(value);
+        else if (name == "--record") opts->record = value;
+        else if (name == "--replay") opts->replay = value;
+        else return false;
+    }
+    if (opts->workload != "static" && opts->workload != "linear" && opts->workload != "wander")
+        return false;
+    if (opts->positions != "uniform" && opts->positions != "clusters" && opts->positions != "hotspots")
+        return false;
+    if (opts->sizes != "fixed" && opts->sizes != "pareto")
+        return false;
+    if (opts->motion != "drift" && opts->motion != "bounded" && opts->motion != "waypoints")
+        return false;
+    if (!(opts->hysteresis >= 0.f && opts->hysteresis <= 1.f))
+        return false;
+    return (opts->objects >= 0 && opts->queries >= 0 && opts->ticks > 0 && opts->fanout >= 2 && opts->fanout <= 255);
+}
+
+// Stores the handler in tree too if it is an RTreeQueryHandler
+static QueryHandler* createCandidate(const BenchOptions& opts, const BoundingBox3f& region, RTreeQueryHandler** tree) {
+    if (opts.handler == "bruteforce")
+        return new BruteForceQueryHandler();
+    if (opts.handler == "rtree") {
+        *tree = new RTreeQueryHandler(opts.fanout);
+        (*tree)->rebuildThreshold(opts.rebuildThreshold);
+        (*tree)->backgroundRebuild(opts.backgroundRebuild);
+        return *tree;
+    }
+    if (opts.handler == "doublebuffered")
+        return new DoubleBufferedQueryHandler(new RTreeQueryHandler(opts.fanout));
+    if (opts.handler == "sharded") {
+        std::vector<QueryHandler*> shards;
+        for(int i = 0; i < 4; i++)
+            shards.push_back(new RTreeQueryHandler(opts.fanout));
+        return new ShardedQueryHandler(region, 2, 2, 1, shards);
+    }
+    return NULL;
+}
+
+// Stores the validator in validator too if validating
+static QueryHandler* createHandler(const BenchOptions& opts, const BoundingBox3f& region, RTreeQueryHandler** tree, ValidatingQueryHandler** validator) {
+    QueryHandler* handler = createCandidate(opts, region, tree);
+    if (handler != NULL && opts.validate)
+        handler = *validator = new ValidatingQueryHandler(handler);
+    return handler;
+}
+
+static void configureSimulator(const BenchOptions& opts, Simulator* simulator) {
+    bool planar = !opts.volume;
+    simulator->seed(opts.seed);
+    simulator->planarQueries(planar);
+    simulator->queryHysteresis(opts.hysteresis);
+
+    if (opts.positions == "clusters")
+        simulator->positions(new GaussianClusterPositions(16, 0.03f, planar));
+    else if (opts.positions == "hotspots")
+        simulator->positions(new ZipfHotspotPositions(64, 1.f, 0.01f, planar));
+    else
+        simulator->positions(new UniformPositions(planar));
+
+    if (opts.sizes == "pareto")
+        simulator->sizes(new ParetoSizes(0.5f, 1.5f, 50.f));
+
+    // Static objects keep their initial motion, with no velocity
+    float speed = (opts.workload == "static") ? 0.f : 10.f;
+    if (opts.motion == "bounded")
+        simulator->motion(new BoundedMotion(speed, planar));
+    else if (opts.motion == "waypoints")
+        simulator->motion(new WaypointMotion(32, speed, planar));
+    else
+        simulator->motion(new DriftMotion(speed, planar));
+}
+
+// Peak resident set size of the process in kilobytes
+static long peakMemoryKB() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+    return usage.ru_maxrss;
+}
+
+// Applies the workload's object updates for the tick at time t
+static void updateObjects(const BenchOptions& opts, Simulator* simulator, const Time& t) {
+    if (opts.workload != "wander")
+        return;
+
+    // A tenth of the objects pick a new heading each tick
+    for(Simulator::ObjectIterator it = simulator->objectsBegin(); it != simulator->objectsEnd(); it++) {
+        if (randFloat() >= 0.1f)
+            continue;
+        Object* obj = *it;
+        obj->position( MotionVector3f(t, obj->position(t), Vector3f(randFloat() * 20.f - 10.f, randFloat() * 20.f - 10.f, 0.f)) );
+    }
+}
+
+// Returns the index of the query in the simulator, or in the trace when
+// replaying, or -1 if it has been deleted
+static int queryIndex(const Query* query, Simulator* simulator, TraceReplayer* replayer) {
+    int idx = 0;
+    if (replayer != NULL) {
+        for(uint32 i = 0; i < replayer->queryCount(); i++)
+            if (replayer->query(i) == query)
+                return i;
+        return -1;
+    }
+    for(Simulator::QueryIterator it = simulator->queriesBegin(); it != simulator->queriesEnd(); it++, idx++)
+        if (*it == query)
+            return idx;
+    return -1;
+}
+
+// Lists the first few divergences found by the validator
+static void reportDivergences(const ValidatingQueryHandler* validator, Simulator* simulator, TraceReplayer* replayer) {
+    const std::vector<ValidatingQueryHandler::Divergence>& divs = validator->divergences();
+    for(uint32 i = 0; i < divs.size() && i < ProxBench_max_reported_divergences; i++) {
+        const ValidatingQueryHandler::Divergence& div = divs[i];
+        int query_idx = queryIndex(div.query, simulator, replayer);
+
+        std::cout << "divergence: t=" << div.time.microseconds() << "us query=";
+        if (query_idx >= 0)
+            std::cout << query_idx;
+        else
+            std::cout << "deleted";
+        std::cout << " object=" << std::hex << std::setfill('0');
+        for(const unsigned char* b = (const unsigned char*)div.object.begin(); b != div.object.end(); b++)
+            std::cout << std::setw(2) << (int)*b;
+        std::cout << std::dec << std::setfill(' ');
+        std::cout << ((div.type == ValidatingQueryHandler::Divergence::Missed) ? " missed" : " spurious") << std::endl;
+    }
+}
+
+// Runs the simulated workload, timing each handler tick
+static void runSimulation(const BenchOptions& opts, Simulator* simulator, const BoundingBox3f& region, std::vector<int64>* latencies, uint64* events, long* init_memory) {
+    Time t(0);
+    simulator->initialize(t, region, opts.objects, opts.queries);
+    *init_memory = peakMemoryKB();
+
+    for(int tick = 0; tick < opts.ticks; tick++) {
+        t += Duration::milliseconds(ProxBench_tick_ms);
+        // Workload and generator updates are applied outside the timer so
+        // only the handler is measured
+        updateObjects(opts, simulator, t);
+        simulator->updateMotion(t);
+
+        Timer tick_timer;
+        tick_timer.start();
+        simulator->tick(t);
+        latencies->push_back( tick_timer.elapsed().microseconds() );
+
+        // Drain results so event queues don't grow over the run
+        for(Simulator::QueryIterator it = simulator->queriesBegin(); it != simulator->queriesEnd(); it++) {
+            std::deque<QueryEvent> evts;
+            (*it)->popEvents(evts);
+            *events += evts.size();
+        }
+    }
+}
+
+// Replays a whole trace, timing each handler tick the same way
+static void runReplay(TraceReplayer* replayer, QueryHandler* handler, std::vector<int64>* latencies, uint64* events, long* init_memory) {
+    *init_memory = peakMemoryKB();
+    while(replayer->applyUpdates(handler)) {
+        Timer tick_timer;
+        tick_timer.start();
+        replayer->step(handler);
+        latencies->push_back( tick_timer.elapsed().microseconds() );
+    }
+    *events = replayer->eventCount();
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opts;
+    if (!parseOptions(argc, argv, &opts)) {
+        usage();
+        return 1;
+    }
+    srand(opts.seed);
+
+    BoundingBox3f region( Vector3f(-100.f, -100.f, -100.f), Vector3f(100.f, 100.f, 100.f) );
+    RTreeQueryHandler* tree = NULL;
+    ValidatingQueryHandler* validator = NULL;
+    QueryHandler* handler = createHandler(opts, region, &tree, &validator);
+    if (handler == NULL) {
+        usage();
+        return 1;
+    }
+
+    TraceRecorder* recorder = NULL;
+    if (!opts.record.empty()) {
+        handler = recorder = new TraceRecorder(handler, opts.record);
+        if (!recorder->valid()) {
+            std::cerr << "Couldn't open trace " << opts.record << " for writing" << std::endl;
+            return 1;
+        }
+    }
+
+    Simulator* simulator = NULL;
+    TraceReplayer* replayer = NULL;
+    if (!opts.replay.empty()) {
+        replayer = new TraceReplayer(opts.replay);
+        if (!replayer->valid()) {
+            std::cerr << "Couldn't read trace " << opts.replay << std::endl;
+            return 1;
+        }
+    }
+    else {
+        simulator = new Simulator(handler);
+        configureSimulator(opts, simulator);
+    }
+
+    std::vector<int64> latencies;
+    latencies.reserve(opts.ticks);
+    uint64 events = 0;
+    long init_memory = 0;
+    Timer total_timer;
+    total_timer.start();
+    if (replayer != NULL)
+        runReplay(replayer, handler, &latencies, &events, &init_memory);
+    else
+        runSimulation(opts, simulator, region, &latencies, &events, &init_memory);
+    float total_secs = total_timer.elapsed().seconds();
+    if (latencies.empty()) {
+        std::cerr << "No ticks were run" << std::endl;
+        return 1;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    int64 total_latency = 0;
+    for(uint32 i = 0; i < latencies.size(); i++)
+        total_latency += latencies[i];
+
+    std::cout << "handler: " << opts.handler << std::endl;
+    if (replayer != NULL) {
+        std::cout << "workload: replay " << opts.replay << std::endl;
+    }
+    else {
+        std::cout << "workload: " << opts.workload << std::endl;
+        std::cout << "positions: " << opts.positions << (opts.volume ? " volume" : " plane") << std::endl;
+        std::cout << "sizes: " << opts.sizes << std::endl;
+        std::cout << "motion: " << opts.motion << std::endl;
+        std::cout << "objects: " << opts.objects << std::endl;
+        std::cout << "queries: " << opts.queries << std::endl;
+        std::cout << "hysteresis: " << opts.hysteresis << std::endl;
+    }
+    std::cout << "fanout: " << opts.fanout << std::endl;
+    std::cout << "ticks: " << latencies.size() << std::endl;
+    std::cout << "events: " << events << std::endl;
+    std::cout << "ticks_per_sec: " << (total_secs > 0.f ? latencies.size() / total_secs : 0.f) << std::endl;
+    std::cout << "tick_mean_us: " << total_latency / (int64)latencies.size() << std::endl;
+    std::cout << "tick_p50_us: " << latencies[latencies.size() / 2] << std::endl;
+    std::cout << "tick_p99_us: " << latencies[(latencies.size() * 99) / 100] << std::endl;
+    std::cout << "tick_max_us: " << latencies.back() << std::endl;
+    std::cout << "peak_memory_init_kb: " << init_memory << std::endl;
+    std::cout << "peak_memory_kb: " << peakMemoryKB() << std::endl;
+    if (tree != NULL) {
+        RTreeQueryHandler::Metrics metrics = tree->metrics();
+        std::cout << "tree_depth: " << metrics.depth << std::endl;
+        std::cout << "tree_nodes: " << metrics.nodes << std::endl;
+        std::cout << "tree_fill_factor: " << metrics.fillFactor << std::endl;
+        std::cout << "tree_node_volume: " << metrics.nodeVolume << std::endl;
+        std::cout << "tree_object_volume: " << metrics.objectVolume << std::endl;
+        std::cout << "tree_sibling_overlap: " << metrics.siblingOverlap << std::endl;
+        std::cout << "tree_nodes_visited_per_query: " << metrics.nodesVisitedPerQuery << std::endl;
+        std::cout << "tree_rebuilds: " << tree->rebuildCount() << std::endl;
+    }
+    if (validator != NULL) {
+        std::cout << "divergences: " << validator->divergenceCount() << std::endl;
+        reportDivergences(validator, simulator, replayer);
+    }
+    if (recorder != NULL && !recorder->valid())
+        std::cerr << "Couldn't write trace " << opts.record << std::endl;
+
+    // The simulator and replayer own the objects and queries, which must go
+    // before the handler
+    // Validation runs fail on any divergence, so they can be used as tests
+    bool diverged = (validator != NULL && validator->divergenceCount() > 0);
+
+    delete simulator;
+    delete replayer;
+    delete handler;
+
+    return diverged ? 1 : 0;
+}
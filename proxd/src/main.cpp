@@ -0,0 +1,234 @@
+/*  proxd
+ *  main.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <prox/RTreeQueryHandler.hpp>
+#include <prox/RegionPeer.hpp>
+#include <boost/thread.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+
+using namespace Prox;
+
+// Each process owns a slab of the world along the x axis
+static const float ProxD_region_width = 200.f;
+static const float ProxD_region_height = 200.f;
+// Query radius, which is also the margin objects are mirrored within
+static const float ProxD_query_radius = 20.f;
+static const uint32 ProxD_tick_ms = 50;
+static const uint32 ProxD_report_ticks = 20;
+
+static float randFloat() {
+    return float(rand()) / RAND_MAX;
+}
+
+static BoundingBox3f regionBounds(int index, int count) {
+    float min_x = ProxD_region_width * (index - count * .5f);
+    return BoundingBox3f(
+        Vector3f(min_x, -ProxD_region_height * .5f, -ProxD_region_height * .5f),
+        Vector3f(min_x + ProxD_region_width, ProxD_region_height * .5f, ProxD_region_height * .5f)
+    );
+}
+
+static std::string socketPath(const std::string& dir, int index) {
+    std::ostringstream path;
+    path << dir << "/proxd-" << index << ".sock";
+    return path.str();
+}
+
+/** Owns the objects simulated by this process, taking over objects that
+ *  arrive from either neighbour and dropping those that leave.
+ */
+class ProxDaemon : public RegionPeerListener {
+public:
+    ProxDaemon()
+     : arrived(0), departed(0), forwardedEvents(0), activePeer(NULL)
+    {}
+
+    virtual ~ProxDaemon() {}
+
+    virtual void objectArrived(Object* obj) {
+        owned.insert(obj);
+        for(uint32 i = 0; i < peers.size(); i++)
+            if (peers[i] != activePeer)
+                peers[i]->addObject(obj);
+        arrived++;
+    }
+
+    virtual void objectDeparted(Object* obj) {
+        owned.erase(obj);
+        delete obj;
+        departed++;
+    }
+
+    virtual void queryEventsReceived(uint32 query, std::deque<QueryEvent>& events) {
+        forwardedEvents += events.size();
+    }
+
+    std::set<Object*> owned;
+    std::vector<RegionPeer*> peers;
+    uint32 arrived;
+    uint32 departed;
+    uint32 forwardedEvents;
+    RegionPeer* activePeer; // the peer currently sending or receiving
+};
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: proxd index count socket-dir [objects] [ticks]" << std::endl;
+        std::cerr << "Runs region index of count regions, talking to its neighbours through sockets in socket-dir." << std::endl;
+        return 1;
+    }
+
+    int index = atoi(argv[1]);
+    int count = atoi(argv[2]);
+    std::string socket_dir = argv[3];
+    int nobjects = (argc > 4) ? atoi(argv[4]) : 1000;
+    int nticks = (argc > 5) ? atoi(argv[5]) : 200;
+    srand(index + 1);
+
+    QueryHandler* handler = new RTreeQueryHandler(4);
+    ProxDaemon daemon;
+
+    // Listen for the next region before connecting to the previous one, so a
+    // chain of processes started in any order can't deadlock
+    int listen_fd = -1;
+    if (index + 1 < count) {
+        listen_fd = RegionPeer::listen( socketPath(socket_dir, index) );
+        if (listen_fd < 0) {
+            std::cerr << "proxd " << index << ": couldn't listen at " << socketPath(socket_dir, index) << std::endl;
+            return 1;
+        }
+    }
+    if (index > 0) {
+        int fd = -1;
+        while( (fd = RegionPeer::connect( socketPath(socket_dir, index - 1) )) < 0 )
+            boost::this_thread::sleep( boost::posix_time::milliseconds(100) );
+        daemon.peers.push_back( new RegionPeer(handler, regionBounds(index - 1, count), ProxD_query_radius, fd, &daemon) );
+    }
+    if (listen_fd >= 0) {
+        int fd = RegionPeer::accept(listen_fd);
+        close(listen_fd);
+        if (fd < 0) {
+            std::cerr << "proxd " << index << ": accept failed" << std::endl;
+            return 1;
+        }
+        daemon.peers.push_back( new RegionPeer(handler, regionBounds(index + 1, count), ProxD_query_radius, fd, &daemon) );
+    }
+
+    BoundingBox3f region = regionBounds(index, count);
+    Vector3f region_min = region.min();
+    Vector3f region_extents = region.extents();
+    Time t(0);
+
+    uint32 id_source = 0;
+    for(int i = 0; i < nobjects; i++) {
+        // IDs are unique across processes
+        uint32 id_parts[2] = { (uint32)index, id_source++ };
+        unsigned char oid_data[ObjectID::static_size] = {0};
+        memcpy(oid_data, id_parts, sizeof(id_parts));
+
+        Object* obj = new Object(
+            ObjectID(oid_data, ObjectID::static_size),
+            MotionVector3f(
+                t,
+                region_min + Vector3f(region_extents.x * randFloat(), region_extents.y * randFloat(), 0.f),
+                Vector3f(randFloat() * 20.f - 10.f, randFloat() * 20.f - 10.f, 0.f)
+            ),
+            BoundingSphere3f( Vector3f(0, 0, 0), 1.f )
+        );
+        daemon.owned.insert(obj);
+        handler->registerObject(obj);
+        for(uint32 p = 0; p < daemon.peers.size(); p++)
+            daemon.peers[p]->addObject(obj);
+    }
+
+    std::vector<Query*> queries;
+    for(int i = 0; i < 10; i++) {
+        Query* query = new Query(
+            MotionVector3f(t, region_min + Vector3f(region_extents.x * randFloat(), region_extents.y * randFloat(), 0.f), Vector3f(0, 0, 0)),
+            SolidAngle( SolidAngle::Max / 1000 ),
+            ProxD_query_radius
+        );
+        handler->registerQuery(query);
+        queries.push_back(query);
+    }
+
+    uint32 events = 0;
+    for(int tick = 1; tick <= nticks; tick++) {
+        t += Duration::milliseconds(ProxD_tick_ms);
+
+        for(uint32 p = 0; p < daemon.peers.size(); p++) {
+            daemon.activePeer = daemon.peers[p];
+            daemon.peers[p]->receive();
+        }
+
+        handler->tick(t);
+
+        for(uint32 i = 0; i < queries.size(); i++) {
+            std::deque<QueryEvent> evts;
+            queries[i]->popEvents(evts);
+            events += evts.size();
+            // Forwarded as a client in the neighbouring region would see them
+            for(uint32 p = 0; p < daemon.peers.size(); p++)
+                daemon.peers[p]->forwardEvents(i, evts);
+        }
+
+        for(uint32 p = 0; p < daemon.peers.size(); p++) {
+            daemon.activePeer = daemon.peers[p];
+            daemon.peers[p]->send(t);
+        }
+        daemon.activePeer = NULL;
+
+        if (tick % ProxD_report_ticks == 0)
+            std::cout << "proxd " << index << ": tick " << tick
+                      << " owned " << daemon.owned.size()
+                      << " arrived " << daemon.arrived
+                      << " departed " << daemon.departed
+                      << " events " << events
+                      << " forwarded " << daemon.forwardedEvents << std::endl;
+
+        boost::this_thread::sleep( boost::posix_time::milliseconds(ProxD_tick_ms) );
+    }
+
+    // Objects are deleted first so the peers stop tracking them
+    for(std::set<Object*>::iterator it = daemon.owned.begin(); it != daemon.owned.end(); it++)
+        delete *it;
+    for(uint32 p = 0; p < daemon.peers.size(); p++)
+        delete daemon.peers[p];
+    for(uint32 i = 0; i < queries.size(); i++)
+        delete queries[i];
+    delete handler;
+
+    return 0;
+}
@@ -0,0 +1,367 @@
+/*  proxmicro
+ *  main.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <prox/BoundingSphere.hpp>
+#include <prox/SolidAngle.hpp>
+#include <prox/MotionVector.hpp>
+#include <prox/Object.hpp>
+#include <prox/QueryCache.hpp>
+#include <prox/RTreeQueryHandler.hpp>
+#include <prox/Timer.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+
+using namespace Prox;
+
+// Each benchmark is repeated with more iterations until it runs at least this long
+static const int64 ProxMicro_min_run_us = 200000;
+static const uint64 ProxMicro_max_iterations = 1ull << 32;
+// Inputs are cycled through so results don't depend on a single value
+static const uint32 ProxMicro_input_count = 1024;
+
+// Results are accumulated here so the work can't be optimized away
+static volatile float ProxMicro_sink = 0.f;
+
+static float randFloat() {
+    return float(rand()) / RAND_MAX;
+}
+
+static Vector3f randVector(float range) {
+    return Vector3f(randFloat() * 2.f * range - range, randFloat() * 2.f * range - range, randFloat() * 2.f * range - range);
+}
+
+static ObjectID makeID(uint32 i) {
+    unsigned char oid_data[ObjectID::static_size] = {0};
+    memcpy(oid_data, &i, sizeof(i));
+    return ObjectID(oid_data, ObjectID::static_size);
+}
+
+static Object* makeObject(uint32 i) {
+    return new Object(
+        makeID(i),
+        MotionVector3f(Time(0), randVector(100.f), randVector(10.f)),
+        BoundingSphere3f(Vector3f(0, 0, 0), 0.5f + randFloat() * 2.f)
+    );
+}
+
+// Names a benchmark run with the given parameter, e.g. query_cache_exchange/100
+static std::string sizedName(const std::string& name, uint32 size) {
+    std::ostringstream result;
+    result << name << "/" << size;
+    return result.str();
+}
+
+/** A single measured operation.  run() performs it the given number of times;
+ *  anything it needs is prepared in the constructor so only the operation
+ *  itself is timed.
+ */
+class MicroBenchmark {
+public:
+    MicroBenchmark(const std::string& name)
+     : mName(name)
+    {}
+    virtual ~MicroBenchmark() {}
+
+    const std::string& name() const {
+        return mName;
+    }
+
+    virtual void run(uint64 iterations) = 0;
+
+private:
+    std::string mName;
+};
+
+class SphereBenchmark : public MicroBenchmark {
+public:
+    SphereBenchmark(const std::string& name)
+     : MicroBenchmark(name)
+    {
+        for(uint32 i = 0; i < ProxMicro_input_count; i++)
+            mSpheres.push_back( BoundingSphere3f(randVector(100.f), randFloat() * 10.f) );
+    }
+
+protected:
+    const BoundingSphere3f& sphere(uint64 i) const {
+        return mSpheres[i % ProxMicro_input_count];
+    }
+
+    std::vector<BoundingSphere3f> mSpheres;
+};
+
+class SphereMergeBenchmark : public SphereBenchmark {
+public:
+    SphereMergeBenchmark() : SphereBenchmark("bounding_sphere_merge") {}
+
+    virtual void run(uint64 iterations) {
+        float sum = 0.f;
+        for(uint64 i = 0; i < iterations; i++)
+            sum += sphere(i).merge(sphere(i+1)).radius();
+        ProxMicro_sink += sum;
+    }
+};
+
+class SphereContainsBenchmark : public SphereBenchmark {
+public:
+    SphereContainsBenchmark() : SphereBenchmark("bounding_sphere_contains") {}
+
+    virtual void run(uint64 iterations) {
+        uint32 count = 0;
+        for(uint64 i = 0; i < iterations; i++)
+            count += sphere(i).contains(sphere(i+1)) ? 1 : 0;
+        ProxMicro_sink += count;
+    }
+};
+
+class SphereVolumeBenchmark : public SphereBenchmark {
+public:
+    SphereVolumeBenchmark() : SphereBenchmark("bounding_sphere_volume") {}
+
+    virtual void run(uint64 iterations) {
+        float sum = 0.f;
+        for(uint64 i = 0; i < iterations; i++)
+            sum += sphere(i).volume();
+        ProxMicro_sink += sum;
+    }
+};
+
+class SolidAngleBenchmark : public SphereBenchmark {
+public:
+    SolidAngleBenchmark() : SphereBenchmark("solid_angle_from_center_radius") {}
+
+    virtual void run(uint64 iterations) {
+        float sum = 0.f;
+        for(uint64 i = 0; i < iterations; i++)
+            sum += SolidAngle::fromCenterRadius(sphere(i).center(), sphere(i).radius()).asFloat();
+        ProxMicro_sink += sum;
+    }
+};
+
+class MotionPositionBenchmark : public MicroBenchmark {
+public:
+    MotionPositionBenchmark()
+     : MicroBenchmark("motion_vector_position")
+    {
+        for(uint32 i = 0; i < ProxMicro_input_count; i++)
+            mMotions.push_back( MotionVector3f(Time(0), randVector(100.f), randVector(10.f)) );
+    }
+
+    virtual void run(uint64 iterations) {
+        float sum = 0.f;
+        for(uint64 i = 0; i < iterations; i++)
+            sum += mMotions[i % ProxMicro_input_count].position( Time(i * 1000) ).x;
+        ProxMicro_sink += sum;
+    }
+
+private:
+    std::vector<MotionVector3f> mMotions;
+};
+
+class WorldBoundsBenchmark : public MicroBenchmark {
+public:
+    WorldBoundsBenchmark()
+     : MicroBenchmark("object_world_bounds")
+    {
+        for(uint32 i = 0; i < ProxMicro_input_count; i++)
+            mObjects.push_back( makeObject(i) );
+    }
+
+    virtual ~WorldBoundsBenchmark() {
+        for(uint32 i = 0; i < mObjects.size(); i++)
+            delete mObjects[i];
+    }
+
+    virtual void run(uint64 iterations) {
+        float sum = 0.f;
+        for(uint64 i = 0; i < iterations; i++)
+            sum += mObjects[i % ProxMicro_input_count]->worldBounds( Time(i * 1000) ).radius();
+        ProxMicro_sink += sum;
+    }
+
+private:
+    std::vector<Object*> mObjects;
+};
+
+/** Exchanges between two results of the given size which differ in a tenth of
+ *  their objects, as happens when a query's result changes slowly.
+ */
+class QueryCacheExchangeBenchmark : public MicroBenchmark {
+public:
+    QueryCacheExchangeBenchmark(uint32 size)
+     : MicroBenchmark(sizedName("query_cache_exchange", size))
+    {
+        uint32 changed = size / 10;
+        for(uint32 i = 0; i < size; i++) {
+            mFirst.add( makeID(i) );
+            mSecond.add( makeID(i < changed ? size + i : i) );
+        }
+    }
+
+    virtual void run(uint64 iterations) {
+        uint32 count = 0;
+        for(uint64 i = 0; i < iterations; i++) {
+            std::deque<QueryEvent> changes;
+            mCurrent.exchange( (i % 2 == 0) ? mFirst : mSecond, &changes );
+            count += changes.size();
+        }
+        ProxMicro_sink += count;
+    }
+
+private:
+    QueryCache mFirst;
+    QueryCache mSecond;
+    QueryCache mCurrent;
+};
+
+/** Fills an RTree's root leaf, optionally inserting one more object so the
+ *  leaf is split.  RTree_split_node is internal to the handler, so its cost
+ *  is the difference between the two variants, reported by main().
+ */
+class RTreeFillBenchmark : public MicroBenchmark {
+public:
+    RTreeFillBenchmark(uint8 fanout, bool split)
+     : MicroBenchmark(sizedName(split ? "rtree_fill_and_split" : "rtree_fill", fanout)),
+       mFanout(fanout),
+       mSplit(split)
+    {
+        for(uint32 i = 0; i < (uint32)fanout + 1; i++)
+            mObjects.push_back( makeObject(i) );
+    }
+
+    virtual ~RTreeFillBenchmark() {
+        for(uint32 i = 0; i < mObjects.size(); i++)
+            delete mObjects[i];
+    }
+
+    virtual void run(uint64 iterations) {
+        uint32 count = mFanout + (mSplit ? 1 : 0);
+        for(uint64 i = 0; i < iterations; i++) {
+            RTreeQueryHandler* handler = new RTreeQueryHandler(mFanout);
+            for(uint32 j = 0; j < count; j++)
+                handler->registerObject(mObjects[j]);
+            for(uint32 j = 0; j < count; j++)
+                mObjects[j]->removeChangeListener(handler);
+            delete handler;
+        }
+    }
+
+private:
+    uint8 mFanout;
+    bool mSplit;
+    std::vector<Object*> mObjects;
+};
+
+// Returns the time per iteration in nanoseconds, storing the iteration count used
+static double measure(MicroBenchmark* bench, uint64* iterations_out) {
+    uint64 iterations = 1;
+    while(true) {
+        Timer timer;
+        timer.start();
+        bench->run(iterations);
+        int64 elapsed = timer.elapsed().microseconds();
+        if (elapsed >= ProxMicro_min_run_us || iterations >= ProxMicro_max_iterations) {
+            *iterations_out = iterations;
+            return (elapsed * 1000.0) / iterations;
+        }
+        // Aim past the minimum so the next run is usually the last
+        uint64 scale = (elapsed > 0) ? (uint64)(ProxMicro_min_run_us * 1.5 / elapsed) + 1 : 100;
+        iterations *= std::min(std::max(scale, (uint64)2), (uint64)100);
+    }
+}
+
+static void report(const std::string& name, uint64 iterations, double ns_per_op) {
+    std::cout << name << "," << iterations << "," << ns_per_op << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 2) {
+        std::cerr << "Usage: proxmicro [name-filter]" << std::endl;
+        std::cerr << "Times geometric primitives, QueryCache and RTree splits, printing benchmark,iterations,ns_per_op lines." << std::endl;
+        return 1;
+    }
+    std::string filter = (argc > 1) ? argv[1] : "";
+    srand(1);
+
+    std::vector<MicroBenchmark*> benches;
+    benches.push_back(new SphereMergeBenchmark());
+    benches.push_back(new SphereContainsBenchmark());
+    benches.push_back(new SphereVolumeBenchmark());
+    benches.push_back(new SolidAngleBenchmark());
+    benches.push_back(new MotionPositionBenchmark());
+    benches.push_back(new WorldBoundsBenchmark());
+    for(uint32 size = 10; size <= 100000; size *= 10)
+        benches.push_back(new QueryCacheExchangeBenchmark(size));
+    for(uint32 fanout = 4; fanout <= 64; fanout *= 2) {
+        benches.push_back(new RTreeFillBenchmark(fanout, false));
+        benches.push_back(new RTreeFillBenchmark(fanout, true));
+    }
+
+    std::cout << "benchmark,iterations,ns_per_op" << std::endl;
+    double fill_ns = 0.0;
+    std::string fill_name; // the fill fill_ns was measured for
+    for(uint32 i = 0; i < benches.size(); i++) {
+        MicroBenchmark* bench = benches[i];
+        if (bench->name().find(filter) == std::string::npos)
+            continue;
+
+        uint64 iterations;
+        double ns = measure(bench, &iterations);
+        report(bench->name(), iterations, ns);
+
+        // Each fill is immediately followed by the same fill plus a split.  If
+        // the filter skipped the paired fill, it is measured now, unreported,
+        // so the split's cost is never derived from a different fill.
+        if (bench->name().find("rtree_fill/") == 0) {
+            fill_ns = ns;
+            fill_name = bench->name();
+        }
+        else if (bench->name().find("rtree_fill_and_split/") == 0) {
+            std::string size = bench->name().substr(bench->name().find('/') + 1);
+            if (fill_name != "rtree_fill/" + size) {
+                uint64 fill_iterations;
+                fill_ns = measure(benches[i-1], &fill_iterations);
+                fill_name = benches[i-1]->name();
+                assert(fill_name == "rtree_fill/" + size);
+            }
+            report("rtree_split_node/" + size, iterations, ns - fill_ns);
+        }
+    }
+
+    for(uint32 i = 0; i < benches.size(); i++)
+        delete benches[i];
+
+    return 0;
+}
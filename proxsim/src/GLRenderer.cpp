@@ -178,6 +178,7 @@ void GLRenderer::timer() {
     //printf("Real time elapsed: %f\n", mTimer.elapsed().seconds());
     mTime += Duration::milliseconds(static_cast<uint32>(10));
     //mSeenObjects.clear();
+    mSimulator->updateMotion(mTime);
     mTimer.start();
     mSimulator->tick(mTime);
     printf("Real time elapsed: %f\n", mTimer.elapsed().seconds());
@@ -39,7 +39,7 @@
 #include <prox/ObjectID.hpp>
 #include <prox/Time.hpp>
 #include "SimulatorListener.hpp"
-#include "Timer.hpp"
+#include <prox/Timer.hpp>
 
 namespace ProxSim {
 
@@ -74,7 +74,7 @@ protected:
 
     Prox::Time mTime;
     std::set<Prox::ObjectID> mSeenObjects;
-    Timer mTimer;
+    Prox::Timer mTimer;
 }; // class Renderer
 
 } // namespace ProxSim
@@ -0,0 +1,261 @@
+/*  proxsim
+ *  Generators.cpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Generators.hpp"
+#include <cmath>
+#include <algorithm>
+
+using namespace Prox;
+
+namespace ProxSim {
+
+// How close an entity must come to a waypoint to have reached it
+static const float Generators_waypoint_arrival_distance = 1.f;
+
+// Keeps a point within the region
+static Vector3f Generators_clamp(const Vector3f& pos, const BoundingBox3f& region) {
+    Vector3f result = pos;
+    for(uint32 axis = 0; axis < 3; axis++)
+        result[axis] = std::max(region.min()[axis], std::min(region.max()[axis], result[axis]));
+    return result;
+}
+
+static Vector3f Generators_uniform_point(const BoundingBox3f& region, bool planar, Random& rng) {
+    Vector3f region_min = region.min();
+    Vector3f region_extents = region.extents();
+    return region_min + Vector3f(
+        region_extents.x * rng.uniform(),
+        region_extents.y * rng.uniform(),
+        planar ? 0.f : region_extents.z * rng.uniform()
+    );
+}
+
+
+Random::Random(uint32 seed)
+ : mEngine(seed)
+{
+}
+
+void Random::seed(uint32 seed) {
+    mEngine.seed(seed);
+}
+
+float Random::uniform() {
+    // 24 bits fill a float's mantissa without rounding up to 1
+    return (mEngine() >> 8) / 16777216.f;
+}
+
+float Random::uniform(float lo, float hi) {
+    return lo + (hi - lo) * uniform();
+}
+
+float Random::gaussian() {
+    // Box-Muller, keeping the first sample away from 0 for the log
+    float u1 = 1.f - uniform();
+    float u2 = uniform();
+    return sqrtf(-2.f * logf(u1)) * cosf(2.f * 3.14159265f * u2);
+}
+
+uint32 Random::index(uint32 n) {
+    return std::min((uint32)(uniform() * n), n - 1);
+}
+
+
+UniformPositions::UniformPositions(bool planar)
+ : mPlanar(planar)
+{
+}
+
+Vector3f UniformPositions::generate(const BoundingBox3f& region, Random& rng) {
+    return Generators_uniform_point(region, mPlanar, rng);
+}
+
+
+GaussianClusterPositions::GaussianClusterPositions(uint32 nclusters, float spread, bool planar)
+ : mClusterCount(nclusters),
+   mSpread(spread),
+   mPlanar(planar)
+{
+    assert(nclusters > 0);
+}
+
+Vector3f GaussianClusterPositions::generate(const BoundingBox3f& region, Random& rng) {
+    while(mCenters.size() < mClusterCount)
+        mCenters.push_back( Generators_uniform_point(region, mPlanar, rng) );
+
+    Vector3f sigma = region.extents() * mSpread;
+    Vector3f offset(sigma.x * rng.gaussian(), sigma.y * rng.gaussian(), mPlanar ? 0.f : sigma.z * rng.gaussian());
+    return Generators_clamp(mCenters[pickCluster(rng)] + offset, region);
+}
+
+uint32 GaussianClusterPositions::pickCluster(Random& rng) {
+    return rng.index(mClusterCount);
+}
+
+
+ZipfHotspotPositions::ZipfHotspotPositions(uint32 nhotspots, float exponent, float spread, bool planar)
+ : GaussianClusterPositions(nhotspots, spread, planar)
+{
+    float total = 0.f;
+    for(uint32 k = 1; k <= nhotspots; k++) {
+        total += 1.f / powf((float)k, exponent);
+        mCumulativeWeights.push_back(total);
+    }
+    for(uint32 k = 0; k < nhotspots; k++)
+        mCumulativeWeights[k] /= total;
+}
+
+uint32 ZipfHotspotPositions::pickCluster(Random& rng) {
+    std::vector<float>::iterator it = std::upper_bound(mCumulativeWeights.begin(), mCumulativeWeights.end(), rng.uniform());
+    return std::min((uint32)(it - mCumulativeWeights.begin()), mClusterCount - 1);
+}
+
+
+FixedSizes::FixedSizes(float radius)
+ : mRadius(radius)
+{
+}
+
+BoundingSphere3f FixedSizes::generate(Random& rng) {
+    return BoundingSphere3f(Vector3f(0, 0, 0), mRadius);
+}
+
+
+ParetoSizes::ParetoSizes(float min_radius, float alpha, float max_radius)
+ : mMinRadius(min_radius),
+   mAlpha(alpha),
+   mMaxRadius(max_radius)
+{
+    assert(min_radius > 0.f && alpha > 0.f && max_radius >= min_radius);
+}
+
+BoundingSphere3f ParetoSizes::generate(Random& rng) {
+    float u = 1.f - rng.uniform();
+    float radius = mMinRadius / powf(u, 1.f / mAlpha);
+    return BoundingSphere3f(Vector3f(0, 0, 0), std::min(radius, mMaxRadius));
+}
+
+
+DriftMotion::DriftMotion(float max_speed, bool planar)
+ : mMaxSpeed(max_speed),
+   mPlanar(planar)
+{
+}
+
+Vector3f DriftMotion::velocity(const void* entity, const Vector3f& pos, const BoundingBox3f& region, Random& rng) {
+    return Vector3f(
+        rng.uniform(-mMaxSpeed, mMaxSpeed),
+        rng.uniform(-mMaxSpeed, mMaxSpeed),
+        mPlanar ? 0.f : rng.uniform(-mMaxSpeed, mMaxSpeed)
+    );
+}
+
+
+BoundedMotion::BoundedMotion(float max_speed, bool planar)
+ : DriftMotion(max_speed, planar)
+{
+}
+
+bool BoundedMotion::update(const void* entity, const Vector3f& pos, const Vector3f& vel, const BoundingBox3f& region, Random& rng, Vector3f* new_vel) {
+    // Reflect off any face the entity has crossed while still heading out
+    bool bounced = false;
+    *new_vel = vel;
+    for(uint32 axis = 0; axis < 3; axis++) {
+        if ((pos[axis] < region.min()[axis] && vel[axis] < 0.f) ||
+            (pos[axis] > region.max()[axis] && vel[axis] > 0.f)) {
+            (*new_vel)[axis] = -vel[axis];
+            bounced = true;
+        }
+    }
+    return bounced;
+}
+
+
+WaypointMotion::WaypointMotion(uint32 nwaypoints, float speed, bool planar)
+ : mWaypointCount(nwaypoints),
+   mSpeed(speed),
+   mPlanar(planar)
+{
+    assert(nwaypoints > 1);
+}
+
+Vector3f WaypointMotion::headFor(const void* entity, const Vector3f& pos, Random& rng) {
+    uint32 target = rng.index(mWaypointCount);
+    std::map<const void*, uint32>::iterator it = mTargets.find(entity);
+    if (it != mTargets.end() && target == it->second)
+        target = (target + 1) % mWaypointCount;
+    mTargets[entity] = target;
+
+    Vector3f dir = mWaypoints[target] - pos;
+    if (mPlanar)
+        dir.z = 0.f;
+    float len = dir.length();
+    if (len == 0.f)
+        return Vector3f(0, 0, 0);
+    // Vary the pace a little so crowds spread out along the way
+    return dir * (mSpeed * rng.uniform(0.75f, 1.25f) / len);
+}
+
+Vector3f WaypointMotion::velocity(const void* entity, const Vector3f& pos, const BoundingBox3f& region, Random& rng) {
+    while(mWaypoints.size() < mWaypointCount)
+        mWaypoints.push_back( Generators_uniform_point(region, mPlanar, rng) );
+    return headFor(entity, pos, rng);
+}
+
+bool WaypointMotion::update(const void* entity, const Vector3f& pos, const Vector3f& vel, const BoundingBox3f& region, Random& rng, Vector3f* new_vel) {
+    // Stationary entities never arrive, so would otherwise re-head every tick
+    if (vel.lengthSquared() == 0.f)
+        return false;
+
+    std::map<const void*, uint32>::iterator it = mTargets.find(entity);
+    if (it == mTargets.end())
+        return false;
+
+    // The waypoint is reached once the entity is close to it.  Entities can
+    // also step past it, or be turned away by other updates, so one which is
+    // heading away from it is done with it too.
+    Vector3f to_target = mWaypoints[it->second] - pos;
+    if (mPlanar)
+        to_target.z = 0.f;
+    if (to_target.lengthSquared() > Generators_waypoint_arrival_distance * Generators_waypoint_arrival_distance &&
+        to_target.dot(vel) >= 0.f)
+        return false;
+
+    *new_vel = headFor(entity, pos, rng);
+    return true;
+}
+
+void WaypointMotion::forget(const void* entity) {
+    mTargets.erase(entity);
+}
+
+} // namespace ProxSim
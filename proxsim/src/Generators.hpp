@@ -0,0 +1,192 @@
+/*  proxsim
+ *  Generators.hpp
+ *
+ *  Copyright (c) 2009, Ewen Cheslack-Postava
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *  * Neither the name of libprox nor the names of its contributors may
+ *    be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PROXSIM_GENERATORS_HPP_
+#define _PROXSIM_GENERATORS_HPP_
+
+#include <prox/BoundingBox.hpp>
+#include <prox/BoundingSphere.hpp>
+#include <prox/Vector3.hpp>
+#include <boost/random/mersenne_twister.hpp>
+
+namespace ProxSim {
+
+/** Seeded random numbers, so a workload can be reproduced exactly. */
+class Random {
+public:
+    Random(Prox::uint32 seed);
+
+    void seed(Prox::uint32 seed);
+
+    /// Uniform in [0, 1)
+    float uniform();
+    /// Uniform in [lo, hi)
+    float uniform(float lo, float hi);
+    /// Normally distributed with mean 0 and standard deviation 1
+    float gaussian();
+    /// Uniform in [0, n)
+    Prox::uint32 index(Prox::uint32 n);
+
+private:
+    boost::mt19937 mEngine;
+}; // class Random
+
+/** Chooses where objects and queries start. */
+class PositionGenerator {
+public:
+    virtual ~PositionGenerator() {}
+    virtual Prox::Vector3f generate(const Prox::BoundingBox3f& region, Random& rng) = 0;
+};
+
+/** Chooses the bounds of objects, relative to their positions. */
+class SizeGenerator {
+public:
+    virtual ~SizeGenerator() {}
+    virtual Prox::BoundingSphere3f generate(Random& rng) = 0;
+};
+
+/** Chooses how objects and queries move.  entity identifies the object or
+ *  query for generators which track them individually.
+ */
+class MotionGenerator {
+public:
+    virtual ~MotionGenerator() {}
+
+    /// The initial velocity of an entity starting at pos
+    virtual Prox::Vector3f velocity(const void* entity, const Prox::Vector3f& pos, const Prox::BoundingBox3f& region, Random& rng) = 0;
+    /// Called every tick, returns true and sets new_vel if the entity, now at
+    /// pos and moving with vel, should change course
+    virtual bool update(const void* entity, const Prox::Vector3f& pos, const Prox::Vector3f& vel, const Prox::BoundingBox3f& region, Random& rng, Prox::Vector3f* new_vel) {
+        return false;
+    }
+    /// Called when an entity is removed, so any state kept for it can be freed
+    virtual void forget(const void* entity) {}
+};
+
+/// Uniformly distributed over the region, or the bottom face of it if planar
+class UniformPositions : public PositionGenerator {
+public:
+    UniformPositions(bool planar);
+    virtual Prox::Vector3f generate(const Prox::BoundingBox3f& region, Random& rng);
+private:
+    bool mPlanar;
+};
+
+/// Normally distributed around cluster centers spread uniformly over the
+/// region, with the given standard deviation as a fraction of its size
+class GaussianClusterPositions : public PositionGenerator {
+public:
+    GaussianClusterPositions(Prox::uint32 nclusters, float spread, bool planar);
+    virtual Prox::Vector3f generate(const Prox::BoundingBox3f& region, Random& rng);
+protected:
+    // Picks the cluster the next position is drawn from
+    virtual Prox::uint32 pickCluster(Random& rng);
+
+    Prox::uint32 mClusterCount;
+    float mSpread;
+    bool mPlanar;
+    std::vector<Prox::Vector3f> mCenters; // chosen on first use
+};
+
+/// Like GaussianClusterPositions, but the kth most popular hotspot draws
+/// objects in proportion to 1/k^exponent
+class ZipfHotspotPositions : public GaussianClusterPositions {
+public:
+    ZipfHotspotPositions(Prox::uint32 nhotspots, float exponent, float spread, bool planar);
+protected:
+    virtual Prox::uint32 pickCluster(Random& rng);
+private:
+    std::vector<float> mCumulativeWeights;
+};
+
+/// Every object has the same radius
+class FixedSizes : public SizeGenerator {
+public:
+    FixedSizes(float radius);
+    virtual Prox::BoundingSphere3f generate(Random& rng);
+private:
+    float mRadius;
+};
+
+/// Radii follow a Pareto distribution, so most objects are near the minimum
+/// but a few are far larger, up to the maximum
+class ParetoSizes : public SizeGenerator {
+public:
+    ParetoSizes(float min_radius, float alpha, float max_radius);
+    virtual Prox::BoundingSphere3f generate(Random& rng);
+private:
+    float mMinRadius;
+    float mAlpha;
+    float mMaxRadius;
+};
+
+/// Constant random velocities up to max_speed along each axis, drifting out
+/// of the region forever
+class DriftMotion : public MotionGenerator {
+public:
+    DriftMotion(float max_speed, bool planar);
+    virtual Prox::Vector3f velocity(const void* entity, const Prox::Vector3f& pos, const Prox::BoundingBox3f& region, Random& rng);
+private:
+    float mMaxSpeed;
+    bool mPlanar;
+};
+
+/// Like DriftMotion, but entities bounce off the region's faces
+class BoundedMotion : public DriftMotion {
+public:
+    BoundedMotion(float max_speed, bool planar);
+    virtual bool update(const void* entity, const Prox::Vector3f& pos, const Prox::Vector3f& vel, const Prox::BoundingBox3f& region, Random& rng, Prox::Vector3f* new_vel);
+};
+
+/// Crowds walking at the given speed between a shared set of waypoints
+/// spread over the region, choosing another at random on reaching each one.
+/// Entities without a velocity, e.g. with a speed of zero, stay put.
+class WaypointMotion : public MotionGenerator {
+public:
+    WaypointMotion(Prox::uint32 nwaypoints, float speed, bool planar);
+    virtual Prox::Vector3f velocity(const void* entity, const Prox::Vector3f& pos, const Prox::BoundingBox3f& region, Random& rng);
+    virtual bool update(const void* entity, const Prox::Vector3f& pos, const Prox::Vector3f& vel, const Prox::BoundingBox3f& region, Random& rng, Prox::Vector3f* new_vel);
+    virtual void forget(const void* entity);
+private:
+    // Picks a new waypoint for the entity and returns the velocity toward it
+    Prox::Vector3f headFor(const void* entity, const Prox::Vector3f& pos, Random& rng);
+
+    Prox::uint32 mWaypointCount;
+    float mSpeed;
+    bool mPlanar;
+    std::vector<Prox::Vector3f> mWaypoints; // chosen on first use
+    std::map<const void*, Prox::uint32> mTargets;
+};
+
+} // namespace ProxSim
+
+#endif //_PROXSIM_GENERATORS_HPP_
@@ -32,18 +32,22 @@
 
 #include "Simulator.hpp"
 #include <algorithm>
+#include <cmath>
 
 using namespace Prox;
 
 namespace ProxSim {
 
-static float randFloat() {
-    return float(rand()) / RAND_MAX;
-}
-
 Simulator::Simulator(QueryHandler* handler)
  : mObjectIDSource(0),
-   mHandler(handler)
+   mHandler(handler),
+   mRegion(),
+   mRandom(1),
+   mPositions(new UniformPositions(true)),
+   mSizes(new FixedSizes(sqrtf(3.f))),
+   mMotion(new DriftMotion(10.f, false)),
+   mPlanarQueries(true),
+   mQueryExitScale(1.f)
 {
 }
 
@@ -59,39 +63,72 @@ Simulator::~Simulator() {
         removeQuery(query);
         delete query;
     }
+
+    delete mPositions;
+    delete mSizes;
+    delete mMotion;
+}
+
+void Simulator::positions(PositionGenerator* gen) {
+    delete mPositions;
+    mPositions = gen;
+}
+
+void Simulator::sizes(SizeGenerator* gen) {
+    delete mSizes;
+    mSizes = gen;
+}
+
+void Simulator::motion(MotionGenerator* gen) {
+    delete mMotion;
+    mMotion = gen;
+}
+
+void Simulator::planarQueries(bool planar) {
+    mPlanarQueries = planar;
+}
+
+void Simulator::queryHysteresis(float exit_scale) {
+    assert(exit_scale >= 0.f && exit_scale <= 1.f);
+    mQueryExitScale = exit_scale;
+}
+
+void Simulator::seed(uint32 seed) {
+    mRandom.seed(seed);
 }
 
 void Simulator::initialize(const Time& t, const Prox::BoundingBox3f& region, int nobjects, int nqueries) {
-    Vector3f region_min = region.min();
-    Vector3f region_extents = region.extents();
+    mRegion = region;
 
     for(int i = 0; i < nobjects; i++) {
         mObjectIDSource++;
         unsigned char oid_data[ObjectID::static_size]={0};
         memcpy(oid_data,&mObjectIDSource,ObjectID::static_size<sizeof(mObjectIDSource)?ObjectID::static_size:sizeof(mObjectIDSource));
-        ObjectID oid(oid_data,ObjectID::static_size);;
-        
+
+        Vector3f pos = mPositions->generate(region, mRandom);
+        BoundingSphere3f bounds = mSizes->generate(mRandom);
         Object* obj = new Object(
             ObjectID(oid_data,ObjectID::static_size),
-            MotionVector3f(
-                t,
-                region_min + Vector3f(region_extents.x * randFloat(), region_extents.y * randFloat(), 0.f/*region_extents.z * randFloat()*/),
-                Vector3f(randFloat() * 20.f - 10.f, randFloat() * 20.f - 10.f, randFloat() * 20.f - 10.f)
-            ),
-            BoundingBox3f( Vector3f(-1, -1, -1), Vector3f(1, 1, 1))
+            MotionVector3f(t, pos, Vector3f(0, 0, 0)),
+            bounds
         );
+        // Generators tracking entities need the object to key them by
+        obj->position( MotionVector3f(t, pos, mMotion->velocity(obj, pos, region, mRandom)) );
         addObject(obj);
     }
 
     for(int i = 0; i < nqueries; i++) {
+        Vector3f pos = mPositions->generate(region, mRandom);
         Query* query = new Query(
-            MotionVector3f(
-                t,
-                region_min + Vector3f(region_extents.x * randFloat(), region_extents.y * randFloat(), 0.f/*region_extents.z * randFloat()*/),
-                Vector3f(randFloat() * 20.f - 10.f, randFloat() * 20.f - 10.f, 0.0f/*randFloat() * 2.f - 1.f*/)
-            ),
+            MotionVector3f(t, pos, Vector3f(0, 0, 0)),
             SolidAngle( SolidAngle::Max / 1000 )
         );
+        if (mQueryExitScale != 1.f)
+            query->hysteresis( query->angle() * mQueryExitScale, query->radius() );
+        Vector3f vel = mMotion->velocity(query, pos, region, mRandom);
+        if (mPlanarQueries)
+            vel.z = 0.f;
+        query->position( MotionVector3f(t, pos, vel) );
         addQuery(query);
     }
 }
@@ -111,6 +148,33 @@ void Simulator::tick(const Time& t) {
     mHandler->tick(t);
 }
 
+void Simulator::updateMotion(const Time& t) {
+    std::vector<Object*> changed;
+    std::vector<MotionVector3f> changed_motion;
+    for(ObjectList::iterator it = mObjects.begin(); it != mObjects.end(); it++) {
+        Object* obj = *it;
+        Vector3f pos = obj->position(t);
+        Vector3f vel;
+        if (!mMotion->update(obj, pos, obj->position().velocity(), mRegion, mRandom, &vel))
+            continue;
+        changed.push_back(obj);
+        changed_motion.push_back( MotionVector3f(t, pos, vel) );
+    }
+    if (!changed.empty())
+        Object::updatePositions(&changed[0], &changed_motion[0], changed.size());
+
+    for(QueryList::iterator it = mQueries.begin(); it != mQueries.end(); it++) {
+        Query* query = *it;
+        Vector3f pos = query->position(t);
+        Vector3f vel;
+        if (!mMotion->update(query, pos, query->position().velocity(), mRegion, mRandom, &vel))
+            continue;
+        if (mPlanarQueries)
+            vel.z = 0.f;
+        query->position( MotionVector3f(t, pos, vel) );
+    }
+}
+
 void Simulator::addObject(Object* obj) {
     mObjects.push_back(obj);
     mHandler->registerObject(obj);
@@ -121,6 +185,7 @@ void Simulator::addObject(Object* obj) {
 void Simulator::removeObject(Object* obj) {
     ObjectList::iterator it = std::find(mObjects.begin(), mObjects.end(), obj);
     mObjects.erase(it);
+    mMotion->forget(obj);
 
     for(ListenerList::iterator it = mListeners.begin(); it != mListeners.end(); it++)
         (*it)->simulatorRemovedObject(obj);
@@ -136,6 +201,7 @@ void Simulator::addQuery(Query* query) {
 void Simulator::removeQuery(Query* query) {
     QueryList::iterator it = std::find(mQueries.begin(), mQueries.end(), query);
     mQueries.erase(it);
+    mMotion->forget(query);
 
     for(ListenerList::iterator it = mListeners.begin(); it != mListeners.end(); it++)
         (*it)->simulatorRemovedQuery(query);
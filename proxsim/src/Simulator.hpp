@@ -39,6 +39,7 @@
 #include <prox/Time.hpp>
 #include <prox/BoundingBox.hpp>
 #include "SimulatorListener.hpp"
+#include "Generators.hpp"
 
 namespace ProxSim {
 
@@ -50,11 +51,34 @@ public:
     Simulator(Prox::QueryHandler* handler);
     ~Simulator();
 
+    /// Set how objects and queries are placed, sized and moved, taking
+    /// ownership of the generator.  These must be set before initialize().
+    /// By default objects are spread uniformly over the bottom of the region
+    /// with unit bounds and drift away with constant random velocities, and
+    /// queries do the same within the horizontal plane.
+    void positions(PositionGenerator* gen);
+    void sizes(SizeGenerator* gen);
+    void motion(MotionGenerator* gen);
+    /// Whether queries are kept moving in the horizontal plane, whatever
+    /// velocity the motion generator gives them.  On by default, and must
+    /// also be set before initialize().
+    void planarQueries(bool planar);
+    /// Queries keep objects until they subtend less than exit_scale times
+    /// the entry solid angle.  1, i.e. no hysteresis, by default, and must
+    /// also be set before initialize().
+    void queryHysteresis(float exit_scale);
+    /// Seeds the generators' random numbers, before initialize()
+    void seed(Prox::uint32 seed);
+
     void initialize(const Prox::Time& t, const Prox::BoundingBox3f& region, int nobjects, int nqueries);
 
     void addListener(SimulatorListener* listener);
     void removeListener(SimulatorListener* listener);
 
+    /// Lets the motion generator change the course of objects and queries,
+    /// applying the changes as one batched update.  Call before tick().
+    void updateMotion(const Prox::Time& t);
+    /// Ticks the query handler
     void tick(const Prox::Time& t);
 
     typedef ObjectList::iterator ObjectIterator;
@@ -74,6 +98,13 @@ private:
 
     Prox::int64 mObjectIDSource;
     Prox::QueryHandler* mHandler;
+    Prox::BoundingBox3f mRegion;
+    Random mRandom;
+    PositionGenerator* mPositions;
+    SizeGenerator* mSizes;
+    MotionGenerator* mMotion;
+    bool mPlanarQueries;
+    float mQueryExitScale;
     ObjectList mObjects;
     QueryList mQueries;
     typedef std::list<SimulatorListener*> ListenerList;